@@ -1,6 +1,10 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/video/tracking.hpp>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 
 
 // Create a new unobscured named window for image.
@@ -28,22 +32,37 @@ static void makeWindow(const char *window, const cv::Mat &image, int reset = 0)
     maxY = std::max(maxY, image.rows);
 }
 
-// Return a Hue histogram normalized [0, 255) for the hue-only image hue.
+// Return the count of each of the 256 values in the hue-only image hue.
 //
-cv::Mat_<float> calculateHistogram(const cv::Mat &hue, int binCount)
+static cv::Mat_<float> countHues(const cv::Mat &hue)
 {
     cv::Mat_<float> result;
     static const int max = std::numeric_limits<uchar>::max();
     static const cv::Mat noMask;
-    static const float   hueRanges[]    = {0, max};
-    static const float  *ranges[]       = {hueRanges};
+    static const int     valueCount     = 1 + max;
+    static const float   valueRanges[]  = {0, valueCount};
+    static const float  *ranges[]       = {valueRanges};
     static const int     imageCount     = 1;
     static const int     dimensionCount = 1;
-    static const bool    uniform        = true;
-    static const bool    accumulate     = false;
-    const int binCounts[] = {binCount};
+    static const int     binCounts[]    = {valueCount};
     cv::calcHist(&hue, imageCount, 0, noMask, result,
-                 dimensionCount, binCounts, ranges, uniform, accumulate);
+                 dimensionCount, binCounts, ranges);
+    return result;
+}
+
+// Return a Hue histogram normalized [0, 255) of binCount bins over hue
+// values [0, 255) by summing adjacent counts of hue values from
+// countHues().  The result is what cv::calcHist() would compute from
+// the hue image itself.
+//
+cv::Mat_<float> calculateHistogram(const cv::Mat_<float> &counts,
+                                   int binCount)
+{
+    static const int max = std::numeric_limits<uchar>::max();
+    cv::Mat_<float> result = cv::Mat_<float>::zeros(binCount, 1);
+    const double a = binCount / double(max);
+    for (int v = 0; v < max; ++v) result(cvFloor(v * a)) += counts(v);
+    static const cv::Mat noMask;
     static const double  alpha          = 0.0;
     static const double  beta           = 1.0 * max;
     static const int     normKind       = cv::NORM_MINMAX;
@@ -52,17 +71,21 @@ cv::Mat_<float> calculateHistogram(const cv::Mat &hue, int binCount)
     return result;
 }
 
-static cv::Mat calculateBackProjection(const cv::Mat &hue, const cv::Mat &hist)
+// Return the back projection of hist onto the hue-only image hue in one
+// pass through a table of the bin value for each hue, as
+// cv::calcBackProject() would compute over hue values [0, 255).
+//
+static cv::Mat calculateBackProjection(const cv::Mat &hue,
+                                       const cv::Mat_<float> &hist)
 {
     static const int max = std::numeric_limits<uchar>::max();
-    static const int imageCount = 1;
-    static const float hueRanges[] = {0, max};
-    static const float *ranges[] = {hueRanges};
-    static const double scale = 1.0;
-    static const bool uniform = true;
+    cv::Mat_<uchar> lut = cv::Mat_<uchar>::zeros(1, 1 + max);
+    const double a = hist.rows / double(max);
+    for (int v = 0; v < max; ++v) {
+        lut(v) = cv::saturate_cast<uchar>(hist(cvFloor(v * a)));
+    }
     cv::Mat result;
-    cv::calcBackProject(&hue, imageCount, 0, hist, result,
-                        ranges, scale, uniform);
+    cv::LUT(hue, lut, result);
     return result;
 }
 
@@ -89,6 +112,7 @@ class BackProjectionDemo {
     const cv::Mat &bgrImage;
     cv::Mat hsvImage;
     cv::Mat hueOnly;
+    cv::Mat_<float> hueCounts;
     cv::Mat histImage;
     cv::Mat backProjection;
 
@@ -99,11 +123,15 @@ class BackProjectionDemo {
 
     // The callback passed to createTrackbar() where all state is at p.
     //
+    // Rebin the hue counts cached from the constructor, so each move of
+    // the trackbar costs one table lookup pass over the hue image.
+    //
     static void show(int positionIgnoredUseThisInstead,  void *p)
     {
         BackProjectionDemo *const pD = (BackProjectionDemo *)p;
         const int binCount = MIN(MAX(pD->binsBar, 1), pD->maxBins);
-        const cv::Mat_<float> hist = calculateHistogram(pD->hueOnly, binCount);
+        const cv::Mat_<float> hist
+            = calculateHistogram(pD->hueCounts, binCount);
         pD->backProjection = calculateBackProjection(pD->hueOnly, hist);
         drawHistogram(pD->histImage, hist);
         cv::imshow("Histogram", pD->histImage);
@@ -126,7 +154,7 @@ public:
     // Construct a display with the caption c operating on source image s.
     //
     BackProjectionDemo(const cv::Mat &s):
-        bgrImage(s), hsvImage(), hueOnly(),
+        bgrImage(s), hsvImage(), hueOnly(), hueCounts(),
         histImage(cv::Mat::zeros(s.size(), CV_8UC3)),
         backProjection(s), maxBins(256), binsBar(0)
     {
@@ -138,6 +166,7 @@ public:
         hueOnly.create(hsvImage.size(), hsvImage.depth());
         cv::mixChannels(&hsvImage, srcCount, &hueOnly, dstCount,
                         fromTo, pairCount);
+        hueCounts = countHues(hueOnly);
         makeWindow("Original",        bgrImage, 3);
         makeWindow("HSV Image",       hsvImage);
         makeWindow("Hue Only",        hueOnly);
@@ -155,6 +184,144 @@ public:
     }
 };
 
+// Track a region through a video with cv::CamShift() on the back
+// projection of the hue histogram of that region.
+//
+// Convert and back-project only a window around the last track, grown by
+// half the track size on each side, into buffers allocated once for the
+// whole frame, so the cost of a frame grows with the tracked region and
+// not with the frame.  Back-project the hue channel of the HSV window in
+// place rather than copying it out with cv::mixChannels().  If the track
+// collapses, search the whole frame next time.
+//
+class CamShiftTracker {
+
+    cv::Mat hsvBuffer;
+    cv::Mat maskBuffer;
+    cv::Mat projectionBuffer;
+    cv::Mat_<float> hist;
+    cv::Rect track;
+
+    // Return the part of buffer of size part, after making buffer big
+    // enough for frames of size frame and type.
+    //
+    static cv::Mat partOf(cv::Mat &buffer, const cv::Size &frame, int type,
+                          const cv::Size &part)
+    {
+        buffer.create(frame, type);
+        return buffer(cv::Rect(cv::Point(0, 0), part));
+    }
+
+    // Set mask to the pixels of hsv colorful and bright enough to have a
+    // meaningful hue.
+    //
+    static void maskColors(const cv::Mat &hsv, cv::Mat &mask)
+    {
+        static const cv::Scalar low(0, 30, 10);
+        static const cv::Scalar high(180, 256, 256);
+        cv::inRange(hsv, low, high, mask);
+    }
+
+    static const float **hueRanges()
+    {
+        static const float hueRange[] = {0, 180};
+        static const float *result[] = {hueRange};
+        return result;
+    }
+
+public:
+
+    // Return where the region is in frame.
+    //
+    cv::RotatedRect operator()(const cv::Mat &frame)
+    {
+        static const int imageCount = 1;
+        static const int channels[] = {0};
+        static const cv::TermCriteria criteria(
+            cv::TermCriteria::EPS | cv::TermCriteria::COUNT, 10, 1);
+        const cv::Rect all(cv::Point(0, 0), frame.size());
+        const cv::Point grow(track.width / 2, track.height / 2);
+        const cv::Rect window
+            = cv::Rect(track.tl() - grow, track.br() + grow) & all;
+        const cv::Size size = window.size();
+        cv::Mat hsv = partOf(hsvBuffer, frame.size(), CV_8UC3, size);
+        cv::Mat mask = partOf(maskBuffer, frame.size(), CV_8UC1, size);
+        cv::Mat projection
+            = partOf(projectionBuffer, frame.size(), CV_8UC1, size);
+        cv::cvtColor(frame(window), hsv, cv::COLOR_BGR2HSV);
+        maskColors(hsv, mask);
+        cv::calcBackProject(&hsv, imageCount, channels, hist, projection,
+                            hueRanges());
+        projection &= mask;
+        cv::Rect local = track - window.tl();
+        cv::RotatedRect result = cv::CamShift(projection, local, criteria);
+        if (local.area() > 1) {
+            track = local + window.tl();
+            result.center += cv::Point2f(window.tl());
+        } else {
+            track = all;
+        }
+        return result;
+    }
+
+    // Track the region roi of frame.
+    //
+    CamShiftTracker(const cv::Mat &frame, const cv::Rect &roi): track(roi)
+    {
+        static const int max = std::numeric_limits<uchar>::max();
+        static const int imageCount = 1;
+        static const int channels[] = {0};
+        static const int dimensionCount = 1;
+        static const int binCounts[] = {16};
+        cv::Mat hsv, mask;
+        cv::cvtColor(frame(roi), hsv, cv::COLOR_BGR2HSV);
+        maskColors(hsv, mask);
+        cv::calcHist(&hsv, imageCount, channels, mask, hist,
+                     dimensionCount, binCounts, hueRanges());
+        cv::normalize(hist, hist, 0, max, cv::NORM_MINMAX);
+    }
+};
+
+// Track roi of frame first of the video in file, with frames scaled to
+// 1080 rows, through the rest of the video.  Print the track in each
+// frame, then the frames per second of CamShiftTracker.
+//
+static bool trackVideo(const char *file, const cv::Rect &roi, int first)
+{
+    static const int rows = 1080;
+    cv::VideoCapture video(file);
+    if (!video.isOpened()) return false;
+    cv::Mat frame, scaled;
+    for (int i = 0; i <= first; ++i) {
+        if (!video.read(frame)) return false;
+    }
+    const double s = double(rows) / frame.rows;
+    const cv::Size size(cvRound(frame.cols * s), rows);
+    const cv::Rect area(cvRound(roi.x * s), cvRound(roi.y * s),
+                        cvRound(roi.width * s), cvRound(roi.height * s));
+    const cv::Rect all(cv::Point(0, 0), size);
+    if (area.area() == 0 || (area & all) != area) return false;
+    cv::resize(frame, scaled, size);
+    CamShiftTracker track(scaled, area);
+    int64 ticks = 0;
+    int count = 0;
+    std::cout << std::fixed << std::setprecision(1);
+    do {
+        cv::resize(frame, scaled, size);
+        const int64 tickZero = cv::getTickCount();
+        const cv::RotatedRect box = track(scaled);
+        ticks += cv::getTickCount() - tickZero;
+        std::cout << first + count << ": " << box.center
+                  << " " << box.size << " " << box.angle << std::endl;
+        ++count;
+    } while (video.read(frame));
+    const double seconds = ticks / cv::getTickFrequency();
+    std::cout << count << " frames of " << size.width << "x" << size.height
+              << " at " << (seconds > 0.0 ? count / seconds : 0.0)
+              << " frames per second" << std::endl;
+    return true;
+}
+
 
 int main(int ac, const char *av[])
 {
@@ -166,14 +333,30 @@ int main(int ac, const char *av[])
             cv::waitKey(0);
             return 0;
         }
+    } else if (ac == 6 || ac == 7) {
+        const cv::Rect roi(std::atoi(av[2]), std::atoi(av[3]),
+                           std::atoi(av[4]), std::atoi(av[5]));
+        const int first = ac == 7 ? std::atoi(av[6]) : 0;
+        if (trackVideo(av[1], roi, first)) return 0;
     }
     std::cerr << av[0] << ": Demonstrate back projection."
               << std::endl << std::endl
               << "Usage: " << av[0] << " <image>" << std::endl
+              << "       " << av[0]
+              << " <video> <x> <y> <width> <height> [<frame>]" << std::endl
               << std::endl
               << "Where: <image> is an image file."
+              << std::endl
+              << "       <video> is a video file in which to track the"
+              << std::endl
+              << "       region at <x> <y> <width> <height> of <frame>,"
+              << std::endl
+              << "       which is 0 by default, with CamShift at 1080p."
               << std::endl << std::endl
               << "Example: " << av[0] << " ../resources/hand_sample2.jpg"
+              << std::endl
+              << "Example: " << av[0]
+              << " ../resources/Megamind.avi 440 320 120 200 100"
               << std::endl << std::endl;
     return 1;
 }
@@ -1,7 +1,13 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
 // Show a usage message on cout for program named av0.
 //
 static void showUsage(const char *av0)
@@ -69,34 +75,172 @@ static cv::Mat withConvertTo(const cv::Mat &input, double alpha, int beta)
     return result;
 }
 
+// Return a 256-entry table mapping each uchar value v to the saturated
+// (+ beta (* alpha v)) exactly as gainBiasAt() computes it.
+//
+static cv::Mat makeGainBiasLut(double alpha, int beta)
+{
+    cv::Mat result(1, 256, CV_8U);
+    uchar *const p = result.ptr<uchar>(0);
+    for (int i = 0; i < result.cols; ++i) {
+        const int atI = alpha * i + beta;
+        p[i] = cv::saturate_cast<uchar>(atI);
+    }
+    return result;
+}
+
+// Apply the (+ beta (* alpha (p i j))) linear transform using LUT().
+//
+// There are only 256 possible uchar inputs, so compute the transform
+// once for each of them and then just look up every channel value.
+//
+static cv::Mat withLut(const cv::Mat &input, double alpha, int beta)
+{
+    cv::Mat result;
+    cv::LUT(input, makeGainBiasLut(alpha, beta), result);
+    return result;
+}
+
+// Apply the (+ beta (* alpha (p i j))) linear transform in fixed point.
+//
+// Scale alpha into a 16-bit multiplier a and shift each value v left so
+// that the high half of (* (<< v shift) a) is (* alpha v) truncated,
+// give or take 1 for the rounding of a.
+// Then add or subtract beta with unsigned saturation, and clamp to 255
+// by saturating against 0xff00.  With SSE2 that is 16 channel values per
+// step.  Fall back to withLut() when alpha is out of the range [0,256).
+//
+static cv::Mat withFixedPoint(const cv::Mat &input, double alpha, int beta)
+{
+    if (alpha < 0 || alpha >= 256) return withLut(input, alpha, beta);
+    int shift = 0;
+    while ((1 << shift) <= alpha) ++shift;
+    const unsigned a = std::min(65535, cvRound(alpha * (1 << (16 - shift))));
+    const int b = std::min(65535, std::abs(beta));
+    cv::Mat result(input.size(), input.type());
+    int nRows = input.rows;
+    int nCols = input.cols * input.channels();
+    if (input.isContinuous() && result.isContinuous()) {
+        nCols *= nRows;
+        nRows = 1;
+    }
+    for (int i = 0; i < nRows; ++i) {
+        const uchar *const p = input.ptr<uchar>(i);
+        uchar *const q = result.ptr<uchar>(i);
+        int j = 0;
+#if CV_SSE2
+        const __m128i z = _mm_setzero_si128();
+        const __m128i n = _mm_cvtsi32_si128(shift);
+        const __m128i va = _mm_set1_epi16((short)a);
+        const __m128i vb = _mm_set1_epi16((short)b);
+        const __m128i ceiling = _mm_set1_epi16((short)0xff00);
+        for (; j + 16 <= nCols; j += 16) {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(p + j));
+            __m128i lo = _mm_sll_epi16(_mm_unpacklo_epi8(v, z), n);
+            __m128i hi = _mm_sll_epi16(_mm_unpackhi_epi8(v, z), n);
+            lo = _mm_mulhi_epu16(lo, va);
+            hi = _mm_mulhi_epu16(hi, va);
+            if (beta < 0) {
+                lo = _mm_subs_epu16(lo, vb);
+                hi = _mm_subs_epu16(hi, vb);
+            } else {
+                lo = _mm_adds_epu16(lo, vb);
+                hi = _mm_adds_epu16(hi, vb);
+            }
+            lo = _mm_subs_epu16(_mm_adds_epu16(lo, ceiling), ceiling);
+            hi = _mm_subs_epu16(_mm_adds_epu16(hi, ceiling), ceiling);
+            _mm_storeu_si128((__m128i *)(q + j), _mm_packus_epi16(lo, hi));
+        }
+#endif
+        for (; j < nCols; ++j) {
+            const int atJ = int((unsigned(p[j] << shift) * a) >> 16) + beta;
+            q[j] = cv::saturate_cast<uchar>(atJ);
+        }
+    }
+    return result;
+}
+
 // Apply the (+ beta (* alpha (p i j))) linear transform.
 //
 typedef cv::Mat (*LinearTransform)(const cv::Mat &p, double alpha, int beta);
 
+// Sweep alpha from 1.0 to 3.0 and beta from 0 to 100 in sweepMax steps.
+//
+static const int sweepMax = 10;
+static double sweepAlpha(int i) { return 1.0 + 2.0 * i / sweepMax; }
+static int sweepBeta(int j) { return 0 + 100 * j / sweepMax; }
+
 static void applyTransform(const cv::Mat &input, LinearTransform lt)
 {
-    static const double alphaMax = 2.0;
-    static const int betaMax = 100;
-    static const int max = 10;
-    for (int i = 0; i <= max; ++i) {
-        const double alpha = 1.0 + alphaMax * i / max;
-        for (int j = 0; j <= max; ++j) {
-            const int beta = 0 + betaMax * j / max;
+    for (int i = 0; i <= sweepMax; ++i) {
+        const double alpha = sweepAlpha(i);
+        for (int j = 0; j <= sweepMax; ++j) {
+            const int beta = sweepBeta(j);
             cv::Mat gb = (*lt)(input, alpha, beta);
             cv::imshow("LinearTransform", gb); cv::waitKey(50);
         }
     }
 }
 
+// Run transform over the whole (alpha, beta) sweep a few times and report
+// its average time per frame in milliseconds, and the largest difference
+// of any channel value from what gainBiasAt() computes.
+//
+struct Test {
+    const char *const label;
+    const LinearTransform transform;
+
+    void operator()(const cv::Mat &input) const {
+        static const int runCount = 5;
+        double maxDiff = 0.0;
+        for (int i = 0; i <= sweepMax; ++i) {
+            for (int j = 0; j <= sweepMax; ++j) {
+                const double alpha = sweepAlpha(i);
+                const int beta = sweepBeta(j);
+                const cv::Mat expect = gainBiasAt(input, alpha, beta);
+                const cv::Mat actual = (*transform)(input, alpha, beta);
+                maxDiff = std::max(maxDiff, cv::norm(expect, actual,
+                                                     cv::NORM_INF));
+            }
+        }
+        const int64 tickZero = cv::getTickCount();
+        for (int r = 0; r < runCount; ++r) {
+            for (int i = 0; i <= sweepMax; ++i) {
+                for (int j = 0; j <= sweepMax; ++j) {
+                    (*transform)(input, sweepAlpha(i), sweepBeta(j));
+                }
+            }
+        }
+        const int64 ticks = cv::getTickCount() - tickZero;
+        const double totalSeconds = (double)ticks / cv::getTickFrequency();
+        const int frames = runCount * (sweepMax + 1) * (sweepMax + 1);
+        const double msPerFrame = totalSeconds * 1000 / frames;
+        std::cout << "Average " << label << " time in milliseconds: "
+                  << msPerFrame << " (max diff " << maxDiff << ")"
+                  << std::endl;
+    }
+
+    Test(const char *l, LinearTransform t): label(l), transform(t) {}
+};
+
 int main(int ac, const char *av[])
 {
     const cv::Mat input = useCommandLine(ac, av);
     if (!input.data) return 1;
+    const Test tests[] = {
+        Test("Mat_       ", &gainBiasMat),
+        Test("at()       ", &gainBiasAt),
+        Test("convertTo()", &withConvertTo),
+        Test("LUT()      ", &withLut),
+        Test("fixed point", &withFixedPoint)
+    };
+    const int testsCount = sizeof tests / sizeof tests[0];
+    for (int i = 0; i < testsCount; ++i) (tests[i])(input);
     cv::namedWindow(av[1], cv::WINDOW_AUTOSIZE);
     cv::namedWindow("LinearTransform", cv::WINDOW_AUTOSIZE);
     cv::imshow(av[1], input); cv::waitKey(50);
     static LinearTransform lts[] = {
-        &gainBiasMat, &gainBiasAt, &withConvertTo
+        &gainBiasMat, &gainBiasAt, &withConvertTo, &withLut, &withFixedPoint
     };
     static const int ltsCount = sizeof lts / sizeof lts[0];
     for (int i = 0; i < ltsCount; ++i) applyTransform(input, lts[i]);
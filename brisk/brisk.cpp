@@ -1,5 +1,15 @@
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/nonfree/features2d.hpp>
@@ -12,13 +22,25 @@ static void showUsage(const char *av0)
               << std::endl << std::setw(width) << ""
               << "to locate and outline an object in a scene." << std::endl
               << std::endl
-              << "Usage: " << av0 << " <object> <scene>" << std::endl
+              << "Usage: " << av0 << " <object> <scene> [bench|ransac]"
+              << std::endl
               << std::endl
               << "Where: <object> and <scene> are image files." << std::endl
               << "       <object> has features present in <scene>." << std::endl
               << "       <scene> is where to search for features" << std::endl
               << "               from the <object> image." << std::endl
               << std::endl
+              << "The <object> features are cached in *.features.* files"
+              << std::endl
+              << "in the current directory." << std::endl
+              << std::endl
+              << "With bench, time brute force Hamming matching against"
+              << std::endl
+              << "LSH and cv::BFMatcher instead of showing matches."
+              << std::endl
+              << "With ransac, compare PROSAC with cv::RANSAC instead."
+              << std::endl
+              << std::endl
               << "Example: " << av0 << " ../resources/box.png"
               << " ../resources/box_in_scene.png" << std::endl
               << std::endl;
@@ -38,38 +60,330 @@ struct Features {
     Features(const cv::Mat &i): image(i) {}
 };
 
-// Return brute force matches of BRISK features of object in scene.
+// Return a hex string of a 64-bit FNV-1a hash of tag and the pixels of
+// image, to name files caching what tag computes from image.
 //
-static Matches matchFeatures(Features &object, Features &scene)
+static std::string contentHash(const std::string &tag, const cv::Mat &image)
+{
+    static const uint64 prime = 1099511628211ULL;
+    uint64 hash = 14695981039346656037ULL;
+    std::ostringstream oss;
+    oss << tag << " " << image.cols << "x" << image.rows << " "
+        << image.type();
+    const std::string s = oss.str();
+    for (int i = 0; i < s.size(); ++i) hash = (hash ^ uchar(s[i])) * prime;
+    const int bytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y) {
+        const uchar *const p = image.ptr(y);
+        for (int i = 0; i < bytes; ++i) hash = (hash ^ p[i]) * prime;
+    }
+    std::ostringstream result;
+    result << std::hex << std::setfill('0') << std::setw(16) << hash;
+    return result.str();
+}
+
+// The keypoints and descriptors of an object image cached in a file
+// named for its pixels and how its features were found.
+//
+class ObjectCache {
+
+    const std::string itsName;
+
+public:
+
+    // Load object features from the cache.  Return true if they were there.
+    //
+    bool load(Features &object) const
+    {
+        cv::FileStorage fs(itsName + ".yml", cv::FileStorage::READ);
+        if (!fs.isOpened()) return false;
+        cv::read(fs["keyPoints"], object.keyPoints);
+        fs["descriptors"] >> object.descriptors;
+        return !object.descriptors.empty()
+            && object.descriptors.rows == object.keyPoints.size();
+    }
+
+    // Cache object features.
+    //
+    // Write a temporary file and rename it so load() never sees a partial
+    // cache.
+    //
+    void save(const Features &object) const
+    {
+        const std::string yml = itsName + ".yml";
+        cv::FileStorage fs(itsName + ".tmp.yml", cv::FileStorage::WRITE);
+        cv::write(fs, "keyPoints", object.keyPoints);
+        fs << "descriptors" << object.descriptors;
+        fs.release();
+        std::rename((itsName + ".tmp.yml").c_str(), yml.c_str());
+    }
+
+    // Cache features computed by tag from image.
+    //
+    ObjectCache(const std::string &tag, const cv::Mat &image):
+        itsName(contentHash(tag, image) + ".features")
+    {}
+};
+
+// Find BRISK features of object and scene, with object features from
+// the cache if they are there.
+//
+static void findFeatures(Features &object, Features &scene)
 {
     static const int threshold = 70;
     static const int octaveCount = 4;
     static const float patternScale = 2.0;
     cv::BRISK briskFeatures(threshold, octaveCount, patternScale);
-    briskFeatures.detect(object.image, object.keyPoints);
+    std::ostringstream tag;
+    tag << "BRISK " << threshold << " " << octaveCount << " "
+        << patternScale;
+    const ObjectCache cache(tag.str(), object.image);
+    const int64 tickZero = cv::getTickCount();
+    const bool cached = cache.load(object);
+    if (!cached) {
+        briskFeatures.detect(object.image, object.keyPoints);
+        briskFeatures.compute(object.image, object.keyPoints,
+                              object.descriptors);
+        cache.save(object);
+    }
+    const double ms = 1000.0 * (cv::getTickCount() - tickZero)
+        / cv::getTickFrequency();
+    std::cout << (cached ? "Loaded " : "Computed ")
+              << object.keyPoints.size() << " object features in "
+              << ms << " ms." << std::endl;
     briskFeatures.detect(scene.image, scene.keyPoints);
     //
     // According to features2d.hpp, this should also work!  =tbl
     //
-    // briskFeatures(object.image, object.keyPoints, object.descriptors);
     // briskFeatures(scene.image, scene.keyPoints, scene.descriptors);
     //
-    briskFeatures.compute(object.image, object.keyPoints, object.descriptors);
     briskFeatures.compute(scene.image, scene.keyPoints, scene.descriptors);
-    // cv::FlannBasedMatcher matcher;
-    // cv::BFMatcher matcher(cv::NORM_HAMMING);
-    cv::flann::LshIndexParams indexParameters(20, 10, 2);
-    cv::Ptr<cv::flann::IndexParams> pIndexParameters(indexParameters);
-    cv::FlannBasedMatcher matcher(pIndexParameters);
+}
+
+// Return the Hamming distance between the bytes descriptors at a and b.
+//
+// Compare 64-bit words with a population count, which compiles to one
+// POPCNT instruction per word with -mpopcnt on x86_64, and to CNT on
+// arm64 without any flag.
+//
+static inline int hammingDistance(const uchar *a, const uchar *b, int bytes)
+{
+    int result = 0, i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        uint64 x, y;
+        std::memcpy(&x, a + i, sizeof x);
+        std::memcpy(&y, b + i, sizeof y);
+        result += __builtin_popcountll(x ^ y);
+    }
+    for (; i < bytes; ++i) result += __builtin_popcount(a[i] ^ b[i]);
+    return result;
+}
+
+// Brute force k-nearest-neighbor matching of binary descriptors by
+// Hamming distance.
+//
+// Each thread takes blocks of queryBlock query descriptors and runs them
+// against trainBlock train descriptors at a time.  The 16 KB of a train
+// block of 64-byte descriptors then stays in L1 cache while every query
+// in the block scans it, and the query block's nearest lists stay in L1
+// across all train blocks.  Spelling out the 64 bytes of BRISK and FREAK
+// descriptors lets the compiler unroll hammingDistance().
+//
+class HammingMatcher {
+
+    enum { queryBlock = 64, trainBlock = 256, maxK = 8 };
+
+    // Match the query blocks in range.
     //
-    // CV_WRAP FlannBasedMatcher( const Ptr<flann::IndexParams>& indexParams=makePtr<flann::KDTreeIndexParams>(),
-    //                    const Ptr<flann::SearchParams>& searchParams=makePtr<flann::SearchParams>() );
+    struct Body: cv::ParallelLoopBody {
+        const cv::Mat &query;
+        const cv::Mat &train;
+        const int k;
+        std::vector<Matches> &matches;
+        void operator()(const cv::Range &range) const {
+            const int bytes = query.cols;
+            int dist[queryBlock][maxK], index[queryBlock][maxK];
+            for (int block = range.start; block < range.end; ++block) {
+                const int q0 = block * queryBlock;
+                const int q1 = std::min(q0 + queryBlock, query.rows);
+                for (int q = 0; q < q1 - q0; ++q) {
+                    std::fill(dist[q], dist[q] + k, INT_MAX);
+                    std::fill(index[q], index[q] + k, -1);
+                }
+                for (int t0 = 0; t0 < train.rows; t0 += trainBlock) {
+                    const int t1 = std::min(t0 + trainBlock, train.rows);
+                    for (int q = q0; q < q1; ++q) {
+                        const uchar *const a = query.ptr(q);
+                        int *const d = dist[q - q0];
+                        int *const n = index[q - q0];
+                        for (int t = t0; t < t1; ++t) {
+                            const uchar *const b = train.ptr(t);
+                            const int h = bytes == 64
+                                ? hammingDistance(a, b, 64)
+                                : hammingDistance(a, b, bytes);
+                            if (h < d[k - 1]) {
+                                int j = k - 1;
+                                for (; j > 0 && h < d[j - 1]; --j) {
+                                    d[j] = d[j - 1];
+                                    n[j] = n[j - 1];
+                                }
+                                d[j] = h;
+                                n[j] = t;
+                            }
+                        }
+                    }
+                }
+                for (int q = q0; q < q1; ++q) {
+                    const int *const d = dist[q - q0];
+                    const int *const n = index[q - q0];
+                    Matches &m = matches[q];
+                    m.clear();
+                    for (int j = 0; j < k && n[j] >= 0; ++j) {
+                        m.push_back(cv::DMatch(q, n[j], d[j]));
+                    }
+                }
+            }
+        }
+        Body(const cv::Mat &q, const cv::Mat &t, int k,
+             std::vector<Matches> &m):
+            query(q), train(t), k(k), matches(m) {}
+    };
+
+public:
+
+    // Set matches[q] to the k nearest train descriptors to query
+    // descriptor q, nearest first, as cv::BFMatcher::knnMatch() does.
     //
+    void knnMatch(const cv::Mat &query, const cv::Mat &train,
+                  std::vector<Matches> &matches, int k) const
+    {
+        CV_Assert(0 < k && k <= maxK);
+        CV_Assert(query.empty() || query.type() == CV_8U);
+        CV_Assert(train.empty() || train.type() == CV_8U);
+        CV_Assert(query.empty() || train.empty() || query.cols == train.cols);
+        matches.resize(query.rows);
+        const int blocks = (query.rows + queryBlock - 1) / queryBlock;
+        cv::parallel_for_(cv::Range(0, blocks),
+                          Body(query, train, k, matches));
+    }
+};
+
+// Return the nearest match in each of knn that is nearer than ratio times
+// the next nearest.
+//
+static Matches ratioTest(const std::vector<Matches> &knn, float ratio)
+{
     Matches result;
-    matcher.match(object.descriptors, scene.descriptors, result);
+    for (int i = 0; i < knn.size(); ++i) {
+        const Matches &m = knn[i];
+        const bool distinct = m.size() == 1
+            || (m.size() > 1 && m[0].distance < ratio * m[1].distance);
+        if (distinct) result.push_back(m[0]);
+    }
     return result;
 }
 
+// Return brute force matches of BRISK features of object in scene that
+// pass the ratio test.
+//
+static Matches matchFeatures(Features &object, Features &scene)
+{
+    static const float ratio = 0.8;
+    findFeatures(object, scene);
+    std::vector<Matches> knn;
+    HammingMatcher().knnMatch(object.descriptors, scene.descriptors, knn, 2);
+    return ratioTest(knn, ratio);
+}
+
+// Return count copies of random rows of train each with bits random bits
+// flipped.
+//
+static cv::Mat perturbed(const cv::Mat &train, int count, int bits,
+                         cv::RNG &rng)
+{
+    cv::Mat result(count, train.cols, CV_8U);
+    for (int i = 0; i < count; ++i) {
+        train.row(rng.uniform(0, train.rows)).copyTo(result.row(i));
+        uchar *const p = result.ptr(i);
+        for (int b = 0; b < bits; ++b) {
+            const int bit = rng.uniform(0, 8 * train.cols);
+            p[bit / 8] ^= uchar(1 << bit % 8);
+        }
+    }
+    return result;
+}
+
+// Print the time, recall and ratio test matches of 2-nearest-neighbor
+// matching of query to train descriptors by LSH, by cv::BFMatcher and by
+// HammingMatcher.  Recall is the fraction of query descriptors matched at
+// the distance of their true nearest neighbor.
+//
+static void benchmarkMatchers(const std::string &what,
+                              const cv::Mat &query, const cv::Mat &train)
+{
+    static const float ratio = 0.8;
+    static const int k = 2;
+    static const char *const name[] = { "LSH", "BFMatcher", "Hamming" };
+    static const int count = sizeof name / sizeof name[0];
+    if (query.empty() || train.empty()) return;
+    const double tickMs = 1000.0 / cv::getTickFrequency();
+    std::vector<Matches> knn[count];
+    double ms[count];
+    for (int m = 0; m < count; ++m) {
+        const int64 tickZero = cv::getTickCount();
+        if (m == 0) {
+            cv::FlannBasedMatcher lsh(
+                cv::makePtr<cv::flann::LshIndexParams>(20, 10, 2));
+            lsh.knnMatch(query, train, knn[m], k);
+        } else if (m == 1) {
+            cv::BFMatcher(cv::NORM_HAMMING).knnMatch(query, train, knn[m], k);
+        } else {
+            HammingMatcher().knnMatch(query, train, knn[m], k);
+        }
+        ms[m] = tickMs * (cv::getTickCount() - tickZero);
+    }
+    std::cout << std::endl << what << ": " << query.rows << " query and "
+              << train.rows << " train descriptors" << std::endl
+              << "    Matcher         ms  Recall  Ratio matches"
+              << std::endl;
+    for (int m = 0; m < count; ++m) {
+        int found = 0;
+        for (int i = 0; i < query.rows; ++i) {
+            const Matches &a = knn[m][i], &e = knn[1][i];
+            found += !a.empty() && a[0].distance == e[0].distance;
+        }
+        std::cout << std::setw(11) << name[m] << std::fixed
+                  << std::setprecision(1) << std::setw(11) << ms[m]
+                  << std::setprecision(3) << std::setw(8)
+                  << double(found) / query.rows
+                  << std::setw(15) << ratioTest(knn[m], ratio).size()
+                  << std::endl;
+    }
+}
+
+// Benchmark matchers on the features of object and scene, then on
+// synthetic descriptors near random ones.
+//
+static void benchmark(Features &object, Features &scene)
+{
+    static const int bytes = 64;
+    static const int bits = 40;
+    static const int counts[] = { 1000, 10000 };
+    static const int countCount = sizeof counts / sizeof counts[0];
+    findFeatures(object, scene);
+    benchmarkMatchers("Object to scene", object.descriptors,
+                      scene.descriptors);
+    cv::RNG rng;
+    for (int i = 0; i < countCount; ++i) {
+        cv::Mat train(counts[i], bytes, CV_8U);
+        rng.fill(train, cv::RNG::UNIFORM, 0, 256);
+        const cv::Mat query = perturbed(train, counts[i], bits, rng);
+        std::ostringstream what;
+        what << "Random with " << bits << " bits flipped";
+        benchmarkMatchers(what.str(), query, train);
+    }
+}
+
 // Return image with matches drawn from object to scene in random colors.
 //
 static cv::Mat drawMatches(Features &object, Features &scene,
@@ -87,27 +401,324 @@ static cv::Mat drawMatches(Features &object, Features &scene,
     return result;
 }
 
+// Return the SPRT decision threshold A for models fitting a fraction
+// epsilon of points when good and delta when bad.  Fitting a model costs
+// about as much as checking fitCost points.
+//
+static double sprtThreshold(double epsilon, double delta)
+{
+    static const double fitCost = 200.0;
+    const double c = (1.0 - delta) * std::log((1.0 - delta) / (1.0 - epsilon))
+        + delta * std::log(delta / epsilon);
+    const double k = fitCost * c + 1.0;
+    double result = k;
+    for (int i = 0; i < 10; ++i) result = k + std::log(result);
+    return result;
+}
+
+// Estimate a homography from point matches ordered by quality with
+// PROSAC, verifying each hypothesis with Wald's SPRT.
+//
+// PROSAC draws its first samples from the best few matches and widens
+// the pool on a schedule that ends in RANSAC's uniform sampling, so a
+// good model usually turns up within a few iterations.  SPRT checks a
+// model against points in random order and rejects it once the odds of
+// a bad model pass A, so a bad model costs a few dozen checks instead of
+// all of them.  Each new best model is refit to its inliers by least
+// squares.  Stop when, for some n best matches with more inliers than
+// chance, a better model would have been sampled with probability
+// confidence.
+//
+class Prosac {
+
+    enum { sampleSize = 4, maxIterations = 20000 };
+
+    std::vector<cv::Point2f> itsFrom;
+    std::vector<cv::Point2f> itsTo;
+    std::vector<int> itsOrder;
+    std::vector<int> itsShuffle;
+    cv::RNG itsRng;
+    int itsIterations;
+    int itsRejected;
+    int itsChecks;
+
+    // Order indexes by increasing distance.
+    //
+    struct ByDistance {
+        const std::vector<float> &distance;
+        bool operator()(int a, int b) const
+        {
+            return distance[a] < distance[b];
+        }
+        ByDistance(const std::vector<float> &d): distance(d) {}
+    };
+
+    // Return true if h maps point i to within threshold of its match.
+    //
+    bool fits(const double *h, int i) const
+    {
+        static const double threshold = 3.0;
+        const cv::Point2f &p = itsFrom[i], &q = itsTo[i];
+        const double w = h[6] * p.x + h[7] * p.y + h[8];
+        if (std::fabs(w) < DBL_EPSILON) return false;
+        const double dx = (h[0] * p.x + h[1] * p.y + h[2]) / w - q.x;
+        const double dy = (h[3] * p.x + h[4] * p.y + h[5]) / w - q.y;
+        return dx * dx + dy * dy < threshold * threshold;
+    }
+
+    // Return the number of points h fits and set fit[i] for each.
+    //
+    int inliers(const cv::Mat &h, std::vector<uchar> &fit) const
+    {
+        const double *const p = h.ptr<double>();
+        int result = 0;
+        fit.resize(itsFrom.size());
+        for (int i = 0; i < fit.size(); ++i) result += fit[i] = fits(p, i);
+        return result;
+    }
+
+    // Set sample to sampleSize distinct points: the n-th best and others
+    // from the n - 1 best when grow, otherwise any of the n best.
+    //
+    void draw(int n, bool grow, int sample[sampleSize])
+    {
+        int count = 0;
+        if (grow) sample[count++] = n - 1;
+        const int pool = grow ? n - 1 : n;
+        while (count < sampleSize) {
+            const int s = itsRng.uniform(0, pool);
+            const int *const end = sample + count;
+            if (std::find(sample, end, s) == end) sample[count++] = s;
+        }
+    }
+
+    // Return true if the triangles of sample turn the same way among the
+    // from points as among the to points.  A homography cannot flip them.
+    //
+    bool orientable(const int sample[sampleSize]) const
+    {
+        static const int triangle[][3] = {
+            {0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3}
+        };
+        for (int t = 0; t < 4; ++t) {
+            const int a = sample[triangle[t][0]];
+            const int b = sample[triangle[t][1]];
+            const int c = sample[triangle[t][2]];
+            const double f
+                = (itsFrom[b] - itsFrom[a]).cross(itsFrom[c] - itsFrom[a]);
+            const double g = (itsTo[b] - itsTo[a]).cross(itsTo[c] - itsTo[a]);
+            if (f * g <= 0.0) return false;
+        }
+        return true;
+    }
+
+    // Return true unless SPRT with threshold a rejects h while checking
+    // points in random order.  Set checked to the points checked and
+    // fitted to those h fits.
+    //
+    bool verify(const double *h, double epsilon, double delta, double a,
+                int &checked, int &fitted)
+    {
+        const int n = itsFrom.size();
+        const double fit = delta / epsilon;
+        const double miss = (1.0 - delta) / (1.0 - epsilon);
+        const int start = itsRng.uniform(0, n);
+        double lambda = 1.0;
+        checked = fitted = 0;
+        while (checked < n) {
+            const int i = itsShuffle[(start + checked++) % n];
+            if (fits(h, i)) {
+                ++fitted;
+                lambda *= fit;
+            } else {
+                lambda *= miss;
+            }
+            if (lambda > a) return false;
+        }
+        return true;
+    }
+
+    // Refit h to the count points in fit by least squares while that
+    // adds inliers.  Return the new count.
+    //
+    int refine(cv::Mat &h, std::vector<uchar> &fit, int count) const
+    {
+        static const int rounds = 3;
+        for (int r = 0; r < rounds; ++r) {
+            std::vector<cv::Point2f> from, to;
+            for (int i = 0; i < fit.size(); ++i) {
+                if (fit[i]) {
+                    from.push_back(itsFrom[i]);
+                    to.push_back(itsTo[i]);
+                }
+            }
+            const cv::Mat g = cv::findHomography(from, to, 0);
+            if (g.empty()) break;
+            std::vector<uchar> more;
+            const int c = inliers(g, more);
+            if (c <= count) break;
+            h = g;
+            fit.swap(more);
+            count = c;
+        }
+        return count;
+    }
+
+    // Return the iterations after which samples from the n best points
+    // would have found a better model than the one fitting fit with
+    // probability confidence, for the n that makes that fewest.  Skip n
+    // where fit might be chance for a bad model fitting a fraction delta
+    // of points.  SPRT with threshold a rejects a good model with
+    // probability 1 / a.
+    //
+    int enough(const std::vector<uchar> &fit, double delta, double a) const
+    {
+        static const double confidence = 0.995;
+        static const double z = 3.0;
+        double result = maxIterations;
+        int count = 0;
+        for (int n = 1; n <= fit.size(); ++n) {
+            count += fit[n - 1];
+            if (n <= sampleSize) continue;
+            const double chance = delta * n + sampleSize
+                + z * std::sqrt(n * delta * (1.0 - delta));
+            if (count < chance) continue;
+            const double good = std::pow(double(count) / n, int(sampleSize))
+                * (1.0 - 1.0 / a);
+            const double k = good < 1.0
+                ? std::log(1.0 - confidence) / std::log(1.0 - good) : 0.0;
+            result = std::min(result, k);
+        }
+        return std::ceil(result);
+    }
+
+public:
+
+    // Return the iterations, SPRT rejections and point checks of the
+    // last estimate.
+    //
+    int iterations() const { return itsIterations; }
+    int rejected()   const { return itsRejected; }
+    int checks()     const { return itsChecks; }
+
+    // Return a homography from the from points to the to points, or an
+    // empty cv::Mat if none is found.  Set mask[i] for the inliers.
+    //
+    cv::Mat operator()(std::vector<uchar> &mask)
+    {
+        const int n = itsFrom.size();
+        mask.assign(n, 0);
+        itsIterations = itsRejected = itsChecks = 0;
+        cv::Mat best;
+        if (n < sampleSize) return best;
+        double epsilon = 0.02, delta = 0.01, deltaSum = 0.0;
+        double a = sprtThreshold(epsilon, delta);
+        std::vector<uchar> bestFit;
+        int bestCount = 0, limit = maxIterations;
+        double tn = maxIterations;
+        for (int i = 0; i < sampleSize; ++i) {
+            tn *= double(sampleSize - i) / (n - i);
+        }
+        int pool = sampleSize, tnPrime = 1;
+        while (itsIterations < limit) {
+            ++itsIterations;
+            if (itsIterations > tnPrime && pool < n) {
+                const double next = tn * (pool + 1) / (pool + 1 - sampleSize);
+                tnPrime += int(std::ceil(next - tn));
+                tn = next;
+                ++pool;
+            }
+            int sample[sampleSize];
+            draw(pool, tnPrime >= itsIterations, sample);
+            if (!orientable(sample)) continue;
+            cv::Point2f from[sampleSize], to[sampleSize];
+            for (int i = 0; i < sampleSize; ++i) {
+                from[i] = itsFrom[sample[i]];
+                to[i] = itsTo[sample[i]];
+            }
+            cv::Mat h = cv::getPerspectiveTransform(from, to);
+            int checked = 0, fitted = 0;
+            const bool good
+                = verify(h.ptr<double>(), epsilon, delta, a, checked, fitted);
+            itsChecks += checked;
+            if (!good) {
+                ++itsRejected;
+                deltaSum += double(fitted) / checked;
+                const double mean = deltaSum / itsRejected;
+                const double d
+                    = std::max(0.001, std::min(0.5 * epsilon, mean));
+                if (std::fabs(d - delta) > 0.05 * delta) {
+                    delta = d;
+                    a = sprtThreshold(epsilon, delta);
+                }
+            } else if (fitted > bestCount) {
+                std::vector<uchar> fit;
+                const int count = refine(h, fit, inliers(h, fit));
+                best = h;
+                bestFit.swap(fit);
+                bestCount = count;
+                epsilon = std::min(0.99, std::max(epsilon, double(count) / n));
+                a = sprtThreshold(epsilon, delta);
+                limit = std::max(itsIterations, enough(bestFit, delta, a));
+            }
+        }
+        for (int i = 0; i < bestFit.size(); ++i) {
+            if (bestFit[i]) mask[itsOrder[i]] = 1;
+        }
+        return best;
+    }
+
+    // Estimate homographies from from to to where distance[i] measures
+    // how bad a match from[i] is to to[i].
+    //
+    Prosac(const std::vector<cv::Point2f> &from,
+           const std::vector<cv::Point2f> &to,
+           const std::vector<float> &distance):
+        itsOrder(from.size()), itsShuffle(from.size()),
+        itsIterations(0), itsRejected(0), itsChecks(0)
+    {
+        for (int i = 0; i < itsOrder.size(); ++i) {
+            itsOrder[i] = itsShuffle[i] = i;
+        }
+        const ByDistance byDistance(distance);
+        std::stable_sort(itsOrder.begin(), itsOrder.end(), byDistance);
+        for (int i = 0; i < itsOrder.size(); ++i) {
+            itsFrom.push_back(from[itsOrder[i]]);
+            itsTo.push_back(to[itsOrder[i]]);
+        }
+        for (int i = int(itsShuffle.size()) - 1; i > 0; --i) {
+            std::swap(itsShuffle[i], itsShuffle[itsRng.uniform(0, i + 1)]);
+        }
+    }
+};
+
 // Find the best homography between the object image and the scene image
-// based on the features in matches.
+// based on the features in matches, trying the closest matches first.
 //
 static cv::Mat findHomography(Features &object, Features &scene,
                               const Matches &matches)
 {
+    std::vector<float> distance;
     for (int i = 0; i < matches.size(); ++i) {
         const cv::DMatch &m = matches[i];
         object.locations.push_back(object.keyPoints[m.queryIdx].pt);
         scene.locations.push_back(scene.keyPoints[m.trainIdx].pt);
+        distance.push_back(m.distance);
     }
-    return cv::findHomography(object.locations, scene.locations, cv::RANSAC);
+    Prosac prosac(object.locations, scene.locations, distance);
+    std::vector<uchar> mask;
+    return prosac(mask);
 }
 
 // Use homography to map corners of the object object to corners in the scene
-// based on the features in matches.
+// based on the features in matches.  Return no corners if no homography
+// fits the matches.
 //
 static std::vector<cv::Point2f> findCorners(Features &object, Features &scene,
                                             const Matches &matches)
 {
     const cv::Mat homography = findHomography(object, scene, matches);
+    if (homography.empty()) return std::vector<cv::Point2f>();
     const int x = object.image.size().width;
     const int y = object.image.size().height;
     std::vector<cv::Point2f> corners;
@@ -122,17 +733,125 @@ static std::vector<cv::Point2f> findCorners(Features &object, Features &scene,
     return result;
 }
 
+// Set from, to and distance to count matches of points in a 320x320
+// square to their images under a fixed homography.  Move all but a
+// fraction inliers of them to random places in a 640x480 scene, and give
+// those worse distances on average, as real matches tend to have.
+// Return the number of inliers.
+//
+static int syntheticMatches(int count, double inliers, cv::RNG &rng,
+                            std::vector<cv::Point2f> &from,
+                            std::vector<cv::Point2f> &to,
+                            std::vector<float> &distance)
+{
+    static const double h[] = {
+        0.9, 0.1, 40.0, -0.08, 1.1, 30.0, 1e-4, 2e-4, 1.0
+    };
+    static const double noise = 0.7;
+    int result = 0;
+    from.clear();
+    to.clear();
+    distance.clear();
+    for (int i = 0; i < count; ++i) {
+        const cv::Point2f p(rng.uniform(0.0, 320.0), rng.uniform(0.0, 320.0));
+        const bool inlier = rng.uniform(0.0, 1.0) < inliers;
+        const double w = h[6] * p.x + h[7] * p.y + h[8];
+        cv::Point2f q(rng.uniform(0.0, 640.0), rng.uniform(0.0, 480.0));
+        if (inlier) {
+            q.x = (h[0] * p.x + h[1] * p.y + h[2]) / w + rng.gaussian(noise);
+            q.y = (h[3] * p.x + h[4] * p.y + h[5]) / w + rng.gaussian(noise);
+        }
+        from.push_back(p);
+        to.push_back(q);
+        distance.push_back(rng.uniform(0.0, 1.0) + (inlier ? 0.0 : 0.4));
+        result += inlier;
+    }
+    return result;
+}
+
+// Print the iterations, SPRT rejections, point checks, time and inliers
+// of Prosac and the time and inliers of cv::findHomography() with
+// cv::RANSAC, which does not report its iterations, estimating the
+// homography from from to to.
+//
+static void compareRansac(const std::string &what,
+                          const std::vector<cv::Point2f> &from,
+                          const std::vector<cv::Point2f> &to,
+                          const std::vector<float> &distance)
+{
+    static const double threshold = 3.0;
+    const double tickMs = 1000.0 / cv::getTickFrequency();
+    std::vector<uchar> mask;
+    int64 tickZero = cv::getTickCount();
+    const cv::Mat h
+        = cv::findHomography(from, to, cv::RANSAC, threshold, mask);
+    const double ransacMs = tickMs * (cv::getTickCount() - tickZero);
+    const int ransacInliers = h.empty() ? 0 : cv::countNonZero(mask);
+    Prosac prosac(from, to, distance);
+    tickZero = cv::getTickCount();
+    const cv::Mat g = prosac(mask);
+    const double prosacMs = tickMs * (cv::getTickCount() - tickZero);
+    const int prosacInliers = g.empty() ? 0 : cv::countNonZero(mask);
+    std::cout << std::endl << what << ": " << from.size() << " matches"
+              << std::endl
+              << "     Method  Iterations  Rejected  Checks      ms"
+              << "  Inliers" << std::endl << std::fixed
+              << std::setprecision(2)
+              << " cv::RANSAC" << std::setw(12) << "-" << std::setw(10)
+              << "-" << std::setw(8) << "-" << std::setw(8) << ransacMs
+              << std::setw(9) << ransacInliers << std::endl
+              << "     PROSAC" << std::setw(12) << prosac.iterations()
+              << std::setw(10) << prosac.rejected()
+              << std::setw(8) << prosac.checks()
+              << std::setw(8) << prosacMs
+              << std::setw(9) << prosacInliers << std::endl;
+}
+
+// Compare Prosac with cv::RANSAC on the matches of object in scene, then
+// on synthetic matches with more and more outliers.
+//
+static void benchmarkRansac(Features &object, Features &scene)
+{
+    static const struct { int count; double inliers; } set[] = {
+        { 500, 0.5 }, { 1000, 0.1 }, { 2000, 0.05 }, { 2000, 0.03 }
+    };
+    static const int setCount = sizeof set / sizeof set[0];
+    const Matches matches = matchFeatures(object, scene);
+    std::vector<cv::Point2f> from, to;
+    std::vector<float> distance;
+    for (int i = 0; i < matches.size(); ++i) {
+        from.push_back(object.keyPoints[matches[i].queryIdx].pt);
+        to.push_back(scene.keyPoints[matches[i].trainIdx].pt);
+        distance.push_back(matches[i].distance);
+    }
+    compareRansac("Object to scene", from, to, distance);
+    cv::RNG rng;
+    for (int i = 0; i < setCount; ++i) {
+        const int inliers = syntheticMatches(set[i].count, set[i].inliers,
+                                             rng, from, to, distance);
+        std::ostringstream what;
+        what << "Synthetic with " << inliers << " inliers";
+        compareRansac(what.str(), from, to, distance);
+    }
+}
+
 int main(int ac, char *av[])
 {
-    if (ac == 3) {
+    const std::string mode = ac == 4 ? av[3] : "";
+    if (ac == 3 || mode == "bench" || mode == "ransac") {
         Features  object(cv::imread(av[1], cv::IMREAD_GRAYSCALE));
         Features scene(cv::imread(av[2], cv::IMREAD_GRAYSCALE));
+        if (object.image.data && scene.image.data && ac == 4) {
+            if (mode == "bench") benchmark(object, scene);
+            if (mode == "ransac") benchmarkRansac(object, scene);
+            return 0;
+        }
         if (object.image.data && scene.image.data) {
             std::cout << std::endl << av[0] << ": Press any key to quit."
                       << std::endl << std::endl;
             const Matches matches = matchFeatures(object, scene);
-            if (matches.empty()) {
-                std::cerr << av[0] << ": No matches found."
+            if (matches.size() < 4) {
+                std::cerr << av[0] << ": Too few matches found."
                           << std::endl << std::endl;
             } else {
                 cv::Mat image = drawMatches(object, scene, matches);
@@ -140,10 +859,15 @@ int main(int ac, char *av[])
                     = findCorners(object, scene, matches);
                 static const cv::Scalar green(0, 255, 0);
                 static const int thickness = 4;
-                cv::line(image, corner[0], corner[1], green, thickness);
-                cv::line(image, corner[1], corner[2], green, thickness);
-                cv::line(image, corner[2], corner[3], green, thickness);
-                cv::line(image, corner[3], corner[0], green, thickness);
+                if (corner.empty()) {
+                    std::cerr << av[0] << ": Object not found."
+                              << std::endl << std::endl;
+                } else {
+                    cv::line(image, corner[0], corner[1], green, thickness);
+                    cv::line(image, corner[1], corner[2], green, thickness);
+                    cv::line(image, corner[2], corner[3], green, thickness);
+                    cv::line(image, corner[3], corner[0], green, thickness);
+                }
                 cv::imshow("BRISK Matches & Object detection", image);
                 cv::waitKey(0);
                 return 0;
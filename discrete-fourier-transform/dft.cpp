@@ -1,6 +1,10 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
 #include <iostream>
+#include <string>
 
 
 // Create a new unobscured named window for image.
@@ -41,6 +45,23 @@ static cv::Mat padOutImage(const cv::Mat &image)
     return result;
 }
 
+// Return a float copy of image padded out to an even optimal DFT size.
+//
+// An even size keeps the packed CCS layout of a real DFT regular, and
+// twice an optimal size is still optimal.
+//
+static cv::Mat padOutImageEven(const cv::Mat &image)
+{
+    static const cv::Scalar zero = cv::Scalar::all(0);
+    cv::Mat result;
+    const int rows = 2 * cv::getOptimalDFTSize((image.rows + 1) / 2);
+    const int cols = 2 * cv::getOptimalDFTSize((image.cols + 1) / 2);
+    cv::copyMakeBorder(image, result, 0, rows - image.rows,
+                       0, cols - image.cols, cv::BORDER_CONSTANT, zero);
+    result.convertTo(result, CV_32F);
+    return result;
+}
+
 // Return image embedded in the complex plane.
 //
 static cv::Mat complexify(const cv::Mat &image)
@@ -100,6 +121,65 @@ static cv::Mat centerOrigin(const cv::Mat &dftMatrix)
     return result;
 }
 
+// Swap the top-left quadrant of dftMatrix with the bottom-right and the
+// top-right quadrant with the bottom-left as centerOrigin() does, but in
+// place one row pair at a time without any temporary matrix.
+//
+static void centerOriginInPlace(cv::Mat &dftMatrix)
+{
+    const cv::Rect crop(0, 0, dftMatrix.cols & -2, dftMatrix.rows & -2);
+    dftMatrix = dftMatrix(crop);
+    const int halfY = dftMatrix.rows / 2;
+    const size_t halfBytes = dftMatrix.cols / 2 * dftMatrix.elemSize();
+    for (int i = 0; i < halfY; ++i) {
+        uchar *const top = dftMatrix.ptr<uchar>(i);
+        uchar *const bottom = dftMatrix.ptr<uchar>(i + halfY);
+        std::swap_ranges(top, top + halfBytes, bottom + halfBytes);
+        std::swap_ranges(top + halfBytes, top + 2 * halfBytes, bottom);
+    }
+}
+
+// Return the magnitude of the full spectrum packed into the CCS result
+// of a forward cv::dft() of a real matrix with even rows and columns.
+//
+// The interior columns of row k of ccs hold the (Re, Im) pairs of the
+// spectrum at row k for columns 1 through cols/2 - 1.  The spectrum of a
+// real image is conjugate symmetric, so the magnitude at (k, j) is also
+// the magnitude at (rows - k, cols - j).  Columns 0 and cols/2 of the
+// spectrum are packed down the first and last columns of ccs.
+//
+static cv::Mat packedMagnitude(const cv::Mat_<float> &ccs)
+{
+    const int rows = ccs.rows;
+    const int cols = ccs.cols;
+    const int halfX = cols / 2;
+    const int halfY = rows / 2;
+    cv::Mat_<float> result(ccs.size());
+    for (int k = 0; k < rows; ++k) {
+        const float *const p = ccs[k];
+        float *const q = result[k];
+        float *const m = result[(rows - k) % rows];
+        for (int j = 1; j < halfX; ++j) {
+            const float re = p[2 * j - 1];
+            const float im = p[2 * j];
+            m[cols - j] = q[j] = std::sqrt(re * re + im * im);
+        }
+    }
+    const int edges[] = { 0, halfX };
+    for (int e = 0; e < 2; ++e) {
+        const int c = e ? cols - 1 : 0;
+        const int j = edges[e];
+        result(0, j) = std::abs(ccs(0, c));
+        result(halfY, j) = std::abs(ccs(rows - 1, c));
+        for (int k = 1; k < halfY; ++k) {
+            const float re = ccs(2 * k - 1, c);
+            const float im = ccs(2 * k, c);
+            result(rows - k, j) = result(k, j) = std::sqrt(re * re + im * im);
+        }
+    }
+    return result;
+}
+
 // Return log(1 + ||DFT(image)||)
 // or     log(1 + sqrt(Real(DFT(image))^2 + Imaginary(DFT(image))^2))
 // with the resulting matrix elements normalized to between 0.0 and 1.0.
@@ -116,10 +196,185 @@ static cv::Mat normalizedLogDiscreteFourierTransform(const cv::Mat &image)
     return result;
 }
 
+// Return what normalizedLogDiscreteFourierTransform() returns, but from
+// a real DFT into the packed CCS layout, which does about half the work
+// and touches half the memory of the complex DFT.
+//
+static cv::Mat
+normalizedLogPackedDiscreteFourierTransform(const cv::Mat &image)
+{
+    static const cv::Scalar one = cv::Scalar::all(1);
+    cv::Mat ccs = padOutImageEven(image);
+    cv::dft(ccs, ccs);
+    cv::Mat result = packedMagnitude(ccs) + one;
+    cv::log(result, result);
+    cv::normalize(result, result, 0.0, 1.0, cv::NORM_MINMAX);
+    return result;
+}
+
+// Report the average milliseconds per spectrum of image computed through
+// the complex DFT and through the real packed DFT.
+//
+static void timeSpectra(const cv::Mat &image)
+{
+    static const int runCount = 20;
+    const double msPerTick = 1000.0 / cv::getTickFrequency() / runCount;
+    const int64 tickZero = cv::getTickCount();
+    for (int i = 0; i < runCount; ++i) {
+        centerOrigin(normalizedLogDiscreteFourierTransform(image));
+    }
+    const int64 tickOne = cv::getTickCount();
+    for (int i = 0; i < runCount; ++i) {
+        cv::Mat spectrum = normalizedLogPackedDiscreteFourierTransform(image);
+        centerOriginInPlace(spectrum);
+    }
+    const int64 tickTwo = cv::getTickCount();
+    std::cout << "Average complex DFT time in milliseconds: "
+              << (tickOne - tickZero) * msPerTick << std::endl
+              << "Average packed  DFT time in milliseconds: "
+              << (tickTwo - tickOne) * msPerTick << std::endl;
+}
+
+// Estimate the global translation between successive frames of a video
+// by phase correlation.
+//
+// Keep the spectrum of the previous frame, windowed to suppress edge
+// effects and padded as padOutImageEven() does, so each new frame costs
+// one forward and one inverse DFT.  operator() returns the shift of frame
+// from the previous frame in pixels to sub-pixel precision, and sets
+// *response to the height of the correlation peak, which approaches 1.0
+// for a clean translation and 0.0 when nothing correlates.
+//
+class PhaseCorrelator {
+
+    cv::Mat itsWindow;
+    cv::Mat itsGray;
+    cv::Mat itsPrevious;
+    cv::Mat itsProduct;
+
+    // Return the complex spectrum of the windowed gray frame.
+    //
+    cv::Mat spectrum(const cv::Mat &frame)
+    {
+        if (frame.channels() == 1) {
+            frame.convertTo(itsGray, CV_32F);
+        } else {
+            cv::cvtColor(frame, itsGray, cv::COLOR_BGR2GRAY);
+            itsGray.convertTo(itsGray, CV_32F);
+        }
+        if (itsWindow.size() != itsGray.size()) {
+            cv::createHanningWindow(itsWindow, itsGray.size(), CV_32F);
+            itsPrevious.release();
+        }
+        cv::multiply(itsGray, itsWindow, itsGray);
+        cv::Mat result = padOutImageEven(itsGray);
+        cv::dft(result, result, cv::DFT_COMPLEX_OUTPUT);
+        return result;
+    }
+
+    // Divide each element of the complex spectrum by its magnitude.
+    //
+    static void whiten(cv::Mat &spectrum)
+    {
+        static const float epsilon = 1.0e-6f;
+        for (int i = 0; i < spectrum.rows; ++i) {
+            float *const p = spectrum.ptr<float>(i);
+            for (int j = 0; j < 2 * spectrum.cols; j += 2) {
+                const float m = std::sqrt(p[j] * p[j] + p[j + 1] * p[j + 1]);
+                const float scale = m > epsilon ? 1.0f / m : 0.0f;
+                p[j] *= scale;
+                p[j + 1] *= scale;
+            }
+        }
+    }
+
+    // Return the offset of the vertex of the parabola through (-1, l),
+    // (0, c), and (+1, r) from 0.
+    //
+    static double vertex(float l, float c, float r)
+    {
+        const double d = l - 2.0 * c + r;
+        return d < 0.0 ? 0.5 * (l - r) / d : 0.0;
+    }
+
+public:
+
+    cv::Point2d operator()(const cv::Mat &frame, double *response = 0)
+    {
+        cv::Mat current = spectrum(frame);
+        cv::Point2d result(0.0, 0.0);
+        double peak = 0.0;
+        if (!itsPrevious.empty()) {
+            static const bool conjugate = true;
+            static const int inverse
+                = cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT;
+            cv::mulSpectrums(current, itsPrevious, itsProduct, 0, conjugate);
+            whiten(itsProduct);
+            cv::dft(itsProduct, itsProduct, inverse);
+            cv::Point at;
+            cv::minMaxLoc(itsProduct, 0, &peak, 0, &at);
+            const cv::Mat_<float> c = itsProduct;
+            const int rows = c.rows;
+            const int cols = c.cols;
+            const int left = (at.x + cols - 1) % cols;
+            const int right = (at.x + 1) % cols;
+            const int up = (at.y + rows - 1) % rows;
+            const int down = (at.y + 1) % rows;
+            const float center = c(at.y, at.x);
+            result.x = at.x + vertex(c(at.y, left), center, c(at.y, right));
+            result.y = at.y + vertex(c(up, at.x), center, c(down, at.x));
+            if (result.x > cols / 2) result.x -= cols;
+            if (result.y > rows / 2) result.y -= rows;
+        }
+        itsPrevious = current;
+        if (response) *response = peak;
+        return result;
+    }
+};
+
+// Print the shift and response of each frame of the video in file from
+// the frame before it, then the frames per second of PhaseCorrelator.
+// Scale frames to 1080 rows first when hd is true.
+//
+static bool reportPhaseShifts(const char *file, bool hd)
+{
+    cv::VideoCapture video(file);
+    if (!video.isOpened()) return false;
+    PhaseCorrelator correlate;
+    cv::Mat frame, scaled;
+    int64 ticks = 0;
+    int count = 0;
+    std::cout << std::fixed << std::setprecision(3);
+    while (video.read(frame)) {
+        if (hd) {
+            static const int rows = 1080;
+            const int cols = (frame.cols * rows + frame.rows / 2) / frame.rows;
+            cv::resize(frame, scaled, cv::Size(cols, rows));
+        } else {
+            scaled = frame;
+        }
+        double response = 0.0;
+        const int64 tickZero = cv::getTickCount();
+        const cv::Point2d shift = correlate(scaled, &response);
+        ticks += cv::getTickCount() - tickZero;
+        std::cout << count << ": " << shift.x << " " << shift.y
+                  << " (" << response << ")" << std::endl;
+        ++count;
+    }
+    const double seconds = ticks / cv::getTickFrequency();
+    std::cout << count << " frames of " << scaled.cols << "x" << scaled.rows
+              << " at " << (seconds > 0.0 ? count / seconds : 0.0)
+              << " frames per second" << std::endl;
+    return true;
+}
+
 
 int main(int ac, const char *av[])
 {
-    if (ac == 2) {
+    if ((ac == 3 || ac == 4) && std::string("phase") == av[2]) {
+        const bool hd = ac == 4 && std::string("1080") == av[3];
+        if (reportPhaseShifts(av[1], hd)) return 0;
+    } else if (ac == 2) {
         const cv::Mat image = cv::imread(av[1], cv::IMREAD_GRAYSCALE);
         if (image.data) {
             makeWindow("Input Image", image, 3);
@@ -127,6 +382,11 @@ int main(int ac, const char *av[])
             makeWindow("normalized logarithmic DFT", nldft);
             const cv::Mat output = centerOrigin(nldft);
             makeWindow("spectrum magnitude", output);
+            cv::Mat packed
+                = normalizedLogPackedDiscreteFourierTransform(image);
+            centerOriginInPlace(packed);
+            makeWindow("packed spectrum magnitude", packed);
+            timeSpectra(image);
             cv::waitKey();
             return 0;
         }
@@ -134,10 +394,20 @@ int main(int ac, const char *av[])
     std::cerr << av[0] << ": Demonstrate the discrete Fourier transform."
               << std::endl << std::endl
               << "Usage: " << av[0] << " <image-file>" << std::endl
-              << std::endl
+              << "       " << av[0] << " <video-file> phase [1080]"
+              << std::endl << std::endl
               << "Where: <image-file> is the name of an image file."
+              << std::endl
+              << "       <video-file> is the name of a video file."
+              << std::endl
+              << "       phase reports the shift of each video frame"
+              << " by phase correlation."
+              << std::endl
+              << "       1080 scales video frames to 1080 rows first."
               << std::endl << std::endl
               << "Example: " << av[0] << " ../resources/lena.jpg"
+              << std::endl
+              << "Example: " << av[0] << " ../resources/Megamind.avi phase"
               << std::endl << std::endl;
     return 1;
 }
@@ -1,6 +1,9 @@
+#include <cmath>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <string>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/nonfree/features2d.hpp>
 
@@ -16,6 +19,10 @@ static void showUsage(const char *av0)
               << "       <scene> is where to search for features" << std::endl
               << "               from the <object> image." << std::endl
               << std::endl
+              << "The <object> features and their FLANN index are cached"
+              << std::endl
+              << "in *.features.* files in the current directory." << std::endl
+              << std::endl
               << "Example: " << av0 << " ../resources/box.png"
               << " ../resources/box_in_scene.png" << std::endl
               << std::endl;
@@ -34,21 +41,127 @@ struct Features {
     Features(const cv::Mat &i): image(i) {}
 };
 
+// Return a hex string of a 64-bit FNV-1a hash of tag and the pixels of
+// image, to name files caching what tag computes from image.
+//
+static std::string contentHash(const std::string &tag, const cv::Mat &image)
+{
+    static const uint64 prime = 1099511628211ULL;
+    uint64 hash = 14695981039346656037ULL;
+    std::ostringstream oss;
+    oss << tag << " " << image.cols << "x" << image.rows << " "
+        << image.type();
+    const std::string s = oss.str();
+    for (int i = 0; i < s.size(); ++i) hash = (hash ^ uchar(s[i])) * prime;
+    const int bytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y) {
+        const uchar *const p = image.ptr(y);
+        for (int i = 0; i < bytes; ++i) hash = (hash ^ p[i]) * prime;
+    }
+    std::ostringstream result;
+    result << std::hex << std::setfill('0') << std::setw(16) << hash;
+    return result.str();
+}
+
+// The keypoints, descriptors and trained FLANN index of an object image
+// cached in files named for its pixels and how its features were found.
+//
+class ObjectCache {
+
+    const std::string itsName;
+
+public:
+
+    // Load object features and their index from the cache.
+    // Return true if they were there.
+    //
+    bool load(Features &object, cv::flann::Index &index) const
+    {
+        cv::FileStorage fs(itsName + ".yml", cv::FileStorage::READ);
+        if (!fs.isOpened()) return false;
+        cv::read(fs["keyPoints"], object.keyPoints);
+        fs["descriptors"] >> object.descriptors;
+        const bool ok = !object.descriptors.empty()
+            && object.descriptors.rows == object.keyPoints.size();
+        return ok && index.load(object.descriptors, itsName + ".flann");
+    }
+
+    // Cache object features and their index.
+    //
+    // Write temporary files and rename them, the .yml last, so load()
+    // never sees a partial cache.
+    //
+    void save(const Features &object, const cv::flann::Index &index) const
+    {
+        const std::string yml = itsName + ".yml";
+        const std::string flann = itsName + ".flann";
+        index.save(flann + ".tmp");
+        cv::FileStorage fs(itsName + ".tmp.yml", cv::FileStorage::WRITE);
+        cv::write(fs, "keyPoints", object.keyPoints);
+        fs << "descriptors" << object.descriptors;
+        fs.release();
+        std::rename((flann + ".tmp").c_str(), flann.c_str());
+        std::rename((itsName + ".tmp.yml").c_str(), yml.c_str());
+    }
+
+    // Cache features computed by tag from image.
+    //
+    ObjectCache(const std::string &tag, const cv::Mat &image):
+        itsName(contentHash(tag, image) + ".features")
+    {}
+};
+
+// Return a match for each scene descriptor to its nearest neighbor in
+// index of object descriptors.  As when matching object to scene, the
+// queryIdx is into object and the trainIdx is into scene.
+//
+static Matches searchIndex(cv::flann::Index &index, const Features &scene)
+{
+    static const int knn = 1;
+    Matches result;
+    if (scene.descriptors.empty()) return result;
+    cv::Mat indices, dists;
+    index.knnSearch(scene.descriptors, indices, dists, knn);
+    for (int i = 0; i < indices.rows; ++i) {
+        const int o = indices.at<int>(i, 0);
+        if (o < 0) continue;
+        const float dist = dists.type() == CV_32S
+            ? dists.at<int>(i, 0) : std::sqrt(dists.at<float>(i, 0));
+        result.push_back(cv::DMatch(o, i, dist));
+    }
+    return result;
+}
+
 // Return matches of object in scene.
 //
+// Index the object's descriptors instead of the scene's, so the object
+// side is cached whole and only the scene is described on each run.
+//
 static Matches matchFeatures(Features &object, Features &scene)
 {
     static const int minHessian = 400;
     cv::SurfFeatureDetector detector(minHessian);
-    detector.detect(object.image, object.keyPoints);
-    detector.detect(scene.image, scene.keyPoints);
     cv::SurfDescriptorExtractor extractor;
-    extractor.compute(object.image, object.keyPoints, object.descriptors);
+    std::ostringstream tag; tag << "SURF " << minHessian << " KDTree";
+    const ObjectCache cache(tag.str(), object.image);
+    cv::flann::Index index;
+    const int64 tickZero = cv::getTickCount();
+    const bool cached = cache.load(object, index);
+    if (!cached) {
+        detector.detect(object.image, object.keyPoints);
+        extractor.compute(object.image, object.keyPoints, object.descriptors);
+        if (object.descriptors.empty()) return Matches();
+        index.build(object.descriptors, cv::flann::KDTreeIndexParams());
+        cache.save(object, index);
+    }
+    const double ms = 1000.0 * (cv::getTickCount() - tickZero)
+        / cv::getTickFrequency();
+    std::cout << (cached ? "Loaded " : "Computed ")
+              << object.keyPoints.size() << " object features in "
+              << ms << " ms." << std::endl;
+    detector.detect(scene.image, scene.keyPoints);
     extractor.compute(scene.image, scene.keyPoints, scene.descriptors);
-    cv::FlannBasedMatcher matcher;
-    Matches result;
-    matcher.match(object.descriptors, scene.descriptors, result);
-    return result;
+    return searchIndex(index, scene);
 }
 
 // Return only good matches in matches.  A good match has distance less
@@ -1,6 +1,11 @@
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 static const int MAX_KERNEL_LENGTH = 31;
@@ -90,35 +95,556 @@ static bool showGaussianBlur(const cv::Mat &src)
     return false;
 }
 
-static bool showMedianBlur(const cv::Mat &src)
+// Return the sigma GaussianBlur() uses for a kernel of size i when its
+// sigma arguments are 0.0, as getGaussianKernel() documents it.
+//
+static double gaussianSigma(int i)
+{
+    return 0.3 * ((i - 1) * 0.5 - 1) + 0.8;
+}
+
+// Blur src through a sequence of increasing sigmas, deriving each level
+// from the one before it instead of from src.
+//
+// Gaussian variances add, so blurring a level of sigma s by
+// sqrt(t * t - s * s) yields the level of sigma t, and that increment is
+// much smaller than t.  The levels are kept in float so rounding does not
+// accumulate.
+//
+// When pyramid is true, a level whose sigma reaches octaveSigma of its
+// own pixels is also decimated to half size, as SIFT builds octaves, so
+// large sigmas blur far fewer pixels.  The variance added by decimating
+// is accounted for, and operator() scales each level back up to src size.
+//
+class GaussianScaleSpace {
+
+    const bool itsPyramid;
+    const cv::Size itsSize;
+    const int itsType;
+    cv::Mat itsLevel;
+    double itsScale;
+    double itsSigma;
+
+public:
+
+    // Return src blurred to sigma, which should not decrease from the
+    // last call.
+    //
+    cv::Mat operator()(double sigma)
+    {
+        static const double octaveSigma = 3.2;
+        static const int minSize = 16;
+        if (itsPyramid) {
+            while (itsScale * itsSigma >= octaveSigma
+                   && std::min(itsLevel.rows, itsLevel.cols) >= minSize) {
+                cv::resize(itsLevel, itsLevel, cv::Size(), 0.5, 0.5,
+                           cv::INTER_AREA);
+                itsSigma = std::sqrt(itsSigma * itsSigma
+                                     + 0.25 / (itsScale * itsScale));
+                itsScale *= 0.5;
+            }
+        }
+        if (sigma > itsSigma) {
+            const double delta
+                = itsScale * std::sqrt(sigma * sigma - itsSigma * itsSigma);
+            cv::GaussianBlur(itsLevel, itsLevel, cv::Size(0, 0), delta, delta);
+            itsSigma = sigma;
+        }
+        cv::Mat result = itsLevel;
+        if (itsLevel.size() != itsSize) {
+            cv::resize(itsLevel, result, itsSize, 0, 0, cv::INTER_LINEAR);
+        }
+        result.convertTo(result, itsType);
+        return result;
+    }
+
+    GaussianScaleSpace(const cv::Mat &src, bool pyramid):
+        itsPyramid(pyramid), itsSize(src.size()), itsType(src.type()),
+        itsScale(1.0), itsSigma(0.0)
+    {
+        src.convertTo(itsLevel, CV_32F);
+    }
+};
+
+// Show the sweep of showGaussianBlur() computed by GaussianScaleSpace.
+//
+static bool showScaleSpaceBlur(const cv::Mat &src, bool pyramid)
 {
-    static const char caption[] = "Median Blur";
+    const char *const caption = pyramid
+        ? "Gaussian Pyramid Scale Space"
+        : "Gaussian Scale Space";
+    if (displayCaption(src, caption)) return true;
+    GaussianScaleSpace scaleSpace(src, pyramid);
+    for (int i = 1; i < MAX_KERNEL_LENGTH; i += 2) {
+        const double sigma = i == 1 ? 0.0 : gaussianSigma(i);
+        const cv::Mat dst = scaleSpace(sigma);
+        if (displayShort(dst, caption)) return true;
+    }
+    return false;
+}
+
+// Report the milliseconds taken by the showGaussianBlur() sweep from src
+// for each kernel, and by both GaussianScaleSpace sweeps, and the PSNR of
+// the last scale space levels against the last GaussianBlur().
+//
+static void timeGaussianSweeps(const cv::Mat &src)
+{
+    const double msPerTick = 1000.0 / cv::getTickFrequency();
+    cv::Mat expect, incremental, pyramidal;
+    const int64 tickZero = cv::getTickCount();
+    for (int i = 1; i < MAX_KERNEL_LENGTH; i += 2) {
+        cv::GaussianBlur(src, expect, cv::Size(i, i), 0.0, 0.0);
+    }
+    const int64 tickOne = cv::getTickCount();
+    GaussianScaleSpace scaleSpace(src, false);
+    for (int i = 1; i < MAX_KERNEL_LENGTH; i += 2) {
+        incremental = scaleSpace(i == 1 ? 0.0 : gaussianSigma(i));
+    }
+    const int64 tickTwo = cv::getTickCount();
+    GaussianScaleSpace pyramid(src, true);
+    for (int i = 1; i < MAX_KERNEL_LENGTH; i += 2) {
+        pyramidal = pyramid(i == 1 ? 0.0 : gaussianSigma(i));
+    }
+    const int64 tickThree = cv::getTickCount();
+    std::cout << "Gaussian sweep from src:  "
+              << (tickOne - tickZero) * msPerTick << " ms" << std::endl
+              << "Gaussian scale space:     "
+              << (tickTwo - tickOne) * msPerTick << " ms, PSNR "
+              << cv::PSNR(expect, incremental) << std::endl
+              << "Gaussian pyramid space:   "
+              << (tickThree - tickTwo) * msPerTick << " ms, PSNR "
+              << cv::PSNR(expect, pyramidal) << std::endl;
+}
+
+// Median filter a stripe of rows of an 8-bit image in time independent
+// of the kernel size, as Perreault and Hebert describe it.
+//
+// Keep a histogram of each column of the kernel height, and slide each
+// down one row by removing the pixel leaving the top and adding the one
+// entering the bottom.  Each histogram has 256 fine bins and 16 coarse
+// ones, each counting a bucket of 16 fine bins.  Slide the coarse kernel
+// histogram across a row by subtracting the coarse column histogram
+// leaving on the left and adding the one entering on the right, then
+// find the bucket holding the median in it.  Only that bucket of the
+// fine kernel histogram is brought up to date, with just the columns it
+// missed since it last held the median, or from scratch when those no
+// longer overlap the kernel.  The median rarely changes buckets from one
+// pixel to the next, so that costs a few operations per pixel on average
+// whatever the kernel size.
+//
+// The padded image has the kernel radius replicated on each side, as
+// cv::medianBlur() extends its border, so no index needs clamping.  Each
+// stripe builds its own column histograms, so stripes run in parallel.
+//
+class ConstantTimeMedian: public cv::ParallelLoopBody {
+
+    const cv::Mat itsPadded;
+    cv::Mat &itsDst;
+    const int itsDiameter;
+
+    typedef std::vector<ushort> Histograms;
+
+    // Add delta to the column histograms for each value in padded row y.
+    //
+    void slide(Histograms &fine, Histograms &coarse, int y, int delta) const
+    {
+        const uchar *const p = itsPadded.ptr<uchar>(y);
+        const int width = itsPadded.cols * itsPadded.channels();
+        for (int k = 0; k < width; ++k) {
+            fine[256 * k + p[k]] += delta;
+            coarse[16 * k + (p[k] >> 4)] += delta;
+        }
+    }
+
+    // Add delta times the 16 bins at column to the 16 bins at h.
+    //
+    static void add(ushort *h, const ushort *column, int delta)
+    {
+        for (int v = 0; v < 16; ++v) h[v] += delta * column[v];
+    }
+
+    // Return the value of rank half in the kernel histogram over the d
+    // columns of channel c from x, where fines are the column histograms.
+    // Bring only the fine bucket holding the median up to date, where
+    // upTo[b] is one past the last column fine bucket b counts.
+    //
+    uchar median(ushort *fine, const ushort *coarse, int upTo[16],
+                 const Histograms &fines, int x, int c) const
+    {
+        const int cn = itsDst.channels();
+        const int d = itsDiameter;
+        const int half = d * d / 2;
+        int sum = 0, b = 0;
+        while (sum + coarse[b] <= half) sum += coarse[b++];
+        ushort *const f = fine + 16 * b;
+        if (upTo[b] <= x) {
+            std::fill(f, f + 16, 0);
+            for (int k = x; k < x + d; ++k) {
+                add(f, &fines[256 * (k * cn + c) + 16 * b], +1);
+            }
+        } else {
+            for (int k = upTo[b]; k < x + d; ++k) {
+                add(f, &fines[256 * ((k - d) * cn + c) + 16 * b], -1);
+                add(f, &fines[256 * (k * cn + c) + 16 * b], +1);
+            }
+        }
+        upTo[b] = x + d;
+        int v = 0;
+        while (sum + f[v] <= half) sum += f[v++];
+        return 16 * b + v;
+    }
+
+public:
+
+    void operator()(const cv::Range &range) const
+    {
+        const int cn = itsDst.channels();
+        const int cols = itsDst.cols;
+        const int d = itsDiameter;
+        const int width = itsPadded.cols * cn;
+        Histograms fines(256 * width), coarses(16 * width);
+        for (int y = range.start; y < range.start + d - 1; ++y) {
+            slide(fines, coarses, y, +1);
+        }
+        for (int y = range.start; y < range.end; ++y) {
+            slide(fines, coarses, y + d - 1, +1);
+            uchar *const q = itsDst.ptr<uchar>(y);
+            for (int c = 0; c < cn; ++c) {
+                ushort fine[256] = { 0 }, coarse[16] = { 0 };
+                int upTo[16] = { 0 };
+                for (int x = 0; x < d; ++x) {
+                    add(coarse, &coarses[16 * (x * cn + c)], +1);
+                }
+                q[c] = median(fine, coarse, upTo, fines, 0, c);
+                for (int x = 1; x < cols; ++x) {
+                    add(coarse, &coarses[16 * ((x - 1) * cn + c)], -1);
+                    add(coarse, &coarses[16 * ((x + d - 1) * cn + c)], +1);
+                    q[x * cn + c] = median(fine, coarse, upTo, fines, x, c);
+                }
+            }
+            slide(fines, coarses, y, -1);
+        }
+    }
+
+    ConstantTimeMedian(const cv::Mat &padded, cv::Mat &dst, int diameter):
+        itsPadded(padded), itsDst(dst), itsDiameter(diameter)
+    {}
+};
+
+// Filter the 8-bit src into dst as cv::medianBlur(src, dst, ksize) does
+// but with ConstantTimeMedian on stripes of rows in parallel.
+//
+// cv::medianBlur() sorts small kernels with a network of min and max
+// operations, which no histogram beats, so leave kernels up to 5 to it.
+// It runs its own constant time filter on larger ones, but serially.
+//
+static void constantTimeMedianBlur(const cv::Mat &src, cv::Mat &dst,
+                                   int ksize)
+{
+    static const int maxSortedSize = 5;
+    CV_Assert(src.depth() == CV_8U && ksize % 2 == 1);
+    if (ksize <= maxSortedSize) {
+        cv::medianBlur(src, dst, ksize);
+        return;
+    }
+    const int r = ksize / 2;
+    cv::Mat padded;
+    cv::copyMakeBorder(src, padded, r, r, r, r, cv::BORDER_REPLICATE);
+    dst.create(src.size(), src.type());
+    const double stripes = std::max(1, src.rows / std::max(64, 4 * ksize));
+    const cv::Range rows(0, src.rows);
+    cv::parallel_for_(rows, ConstantTimeMedian(padded, dst, ksize), stripes);
+}
+
+static bool showMedianBlur(const cv::Mat &src, bool constantTime = false)
+{
+    const char *const caption = constantTime
+        ? "Constant Time Median Blur"
+        : "Median Blur";
     if (displayCaption(src, caption)) return true;
     for (int i = 1; i < MAX_KERNEL_LENGTH; i += 2) {
         const int kernelSize = i;
         cv::Mat dst;
-        cv::medianBlur(src, dst, kernelSize);
+        if (constantTime) {
+            constantTimeMedianBlur(src, dst, kernelSize);
+        } else {
+            cv::medianBlur(src, dst, kernelSize);
+        }
         if (displayShort(dst, caption)) return true;
     }
     return false;
 }
 
-static bool showBilateralBlur(const cv::Mat &src)
+// Report the milliseconds cv::medianBlur() and constantTimeMedianBlur()
+// take on src for each kernel size of the showMedianBlur() sweep, and
+// the largest difference between their results.
+//
+static void timeMedianSweeps(const cv::Mat &src)
 {
-    static const char caption[] = "Bilateral Blur";
+    const double msPerTick = 1000.0 / cv::getTickFrequency();
+    for (int i = 1; i < MAX_KERNEL_LENGTH; i += 2) {
+        cv::Mat expect, actual;
+        const int64 tickZero = cv::getTickCount();
+        cv::medianBlur(src, expect, i);
+        const int64 tickOne = cv::getTickCount();
+        constantTimeMedianBlur(src, actual, i);
+        const int64 tickTwo = cv::getTickCount();
+        std::cout << "Median " << i << "x" << i << ": medianBlur() "
+                  << (tickOne - tickZero) * msPerTick << " ms, constant "
+                  << (tickTwo - tickOne) * msPerTick << " ms, max diff "
+                  << cv::norm(expect, actual, cv::NORM_INF) << std::endl;
+    }
+}
+
+// Approximate cv::bilateralFilter() with a bilateral grid as Chen, Paris,
+// and Durand describe it.
+//
+// Splat each pixel into the cell of a coarse 3-D grid indexed by its
+// position scaled down by sigmaSpace and by its gray level scaled down
+// by sigmaColor, accumulating its channel values and a count.  Blur the
+// grid along each axis with a [1 4 6 4 1] kernel, which is a Gaussian of
+// about one cell.  Then slice the grid by interpolating it trilinearly at
+// each pixel's position and gray level, and divide by the count.
+//
+// The grid has a cell per sigma, so it is only worth building when the
+// sigmas are at least minSpace pixels and minColor gray levels.  Smaller
+// sigmas would make a grid with more cells than the image has pixels,
+// and cv::bilateralFilter() is quick there anyway.
+//
+// Splatting runs in parallel over grid rows, each of which only the
+// pixel rows nearest it write.  Blurring runs in parallel over grid rows
+// along x and z, then over grid columns along y.  Slicing runs in
+// parallel over pixel rows.
+//
+// Edges are found on the gray image, not on the color distance
+// cv::bilateralFilter() uses, so color images differ a little more.  The
+// sweep below also cuts the exact filter off at a diameter of only two
+// sigmaSpace, while the grid does not, so PSNR falls as diameters grow.
+//
+class BilateralGrid {
+
+    enum { pad = 2 };
+
+    const cv::Mat itsSrc;
+    cv::Mat itsGray;
+    const double itsSpace;
+    const double itsColor;
+    int itsWidth;
+    int itsHeight;
+    int itsDepth;
+    std::vector<int> itsFirstRow;
+    std::vector<cv::Vec4f> itsCells;
+
+    int cell(int gy, int gx, int gz) const
+    {
+        return (gy * itsWidth + gx) * itsDepth + gz;
+    }
+    int gridX(int x) const { return int(x / itsSpace + 0.5) + pad; }
+    int gridY(int y) const { return int(y / itsSpace + 0.5) + pad; }
+    int gridZ(int v) const { return int(v / itsColor + 0.5) + pad; }
+
+    // Blur the n cells at stride from p with a [1 4 6 4 1] / 16 kernel.
+    //
+    static void blurLine(cv::Vec4f *p, int n, int stride,
+                         std::vector<cv::Vec4f> &line)
+    {
+        line.assign(n + 4, cv::Vec4f());
+        for (int i = 0; i < n; ++i) line[i + 2] = p[i * stride];
+        for (int i = 0; i < n; ++i) {
+            const cv::Vec4f *const t = &line[i + 2];
+            p[i * stride] = (t[-2] + t[2] + 4 * (t[-1] + t[1]) + 6 * t[0])
+                * (1.0f / 16);
+        }
+    }
+
+    // Blur a range of grid rows along z and x, or a range of grid
+    // columns along y.
+    //
+    struct Blur: cv::ParallelLoopBody {
+        BilateralGrid &g;
+        const bool alongY;
+        void operator()(const cv::Range &range) const {
+            std::vector<cv::Vec4f> line;
+            const int w = g.itsWidth, h = g.itsHeight, d = g.itsDepth;
+            for (int i = range.start; i < range.end; ++i) {
+                if (alongY) {
+                    for (int gz = 0; gz < d; ++gz) {
+                        blurLine(&g.itsCells[g.cell(0, i, gz)], h, w * d,
+                                 line);
+                    }
+                } else {
+                    for (int gx = 0; gx < w; ++gx) {
+                        blurLine(&g.itsCells[g.cell(i, gx, 0)], d, 1, line);
+                    }
+                    for (int gz = 0; gz < d; ++gz) {
+                        blurLine(&g.itsCells[g.cell(i, 0, gz)], w, d, line);
+                    }
+                }
+            }
+        }
+        Blur(BilateralGrid &grid, bool y): g(grid), alongY(y) {}
+    };
+
+    struct Splat: cv::ParallelLoopBody {
+        BilateralGrid &g;
+        void operator()(const cv::Range &range) const {
+            const int cn = g.itsSrc.channels();
+            for (int gy = range.start; gy < range.end; ++gy) {
+                const int yEnd = g.itsFirstRow[gy + 1];
+                for (int y = g.itsFirstRow[gy]; y < yEnd; ++y) {
+                    const uchar *const p = g.itsSrc.ptr<uchar>(y);
+                    const uchar *const v = g.itsGray.ptr<uchar>(y);
+                    for (int x = 0; x < g.itsSrc.cols; ++x) {
+                        const int k = g.cell(gy, g.gridX(x), g.gridZ(v[x]));
+                        cv::Vec4f &c = g.itsCells[k];
+                        for (int i = 0; i < cn; ++i) c[i] += p[x * cn + i];
+                        c[3] += 1.0f;
+                    }
+                }
+            }
+        }
+        Splat(BilateralGrid &grid): g(grid) {}
+    };
+
+    struct Slice: cv::ParallelLoopBody {
+        const BilateralGrid &g;
+        cv::Mat &dst;
+        void operator()(const cv::Range &range) const {
+            const int cn = g.itsSrc.channels();
+            for (int y = range.start; y < range.end; ++y) {
+                const uchar *const v = g.itsGray.ptr<uchar>(y);
+                uchar *const q = dst.ptr<uchar>(y);
+                const float fy = y / g.itsSpace + pad;
+                const int y0 = fy;
+                const float wy = fy - y0;
+                for (int x = 0; x < dst.cols; ++x) {
+                    const float fx = x / g.itsSpace + pad;
+                    const float fz = v[x] / g.itsColor + pad;
+                    const int x0 = fx, z0 = fz;
+                    const float wx = fx - x0, wz = fz - z0;
+                    cv::Vec4f sum;
+                    for (int i = 0; i < 8; ++i) {
+                        const int dy = i >> 2, dx = (i >> 1) & 1, dz = i & 1;
+                        const float w
+                            = (dy ? wy : 1 - wy)
+                            * (dx ? wx : 1 - wx)
+                            * (dz ? wz : 1 - wz);
+                        sum += g.itsCells[g.cell(y0 + dy, x0 + dx, z0 + dz)]
+                            * w;
+                    }
+                    const float scale = sum[3] > 0.0f ? 1.0f / sum[3] : 0.0f;
+                    for (int i = 0; i < cn; ++i) {
+                        const float value = sum[i] * scale;
+                        q[x * cn + i] = cv::saturate_cast<uchar>(value);
+                    }
+                }
+            }
+        }
+        Slice(const BilateralGrid &grid, cv::Mat &d): g(grid), dst(d) {}
+    };
+
+public:
+
+    // The smallest sigmas in pixels and gray levels worth a grid.
+    //
+    enum { minSpace = 4, minColor = 16 };
+
+    // Filter src into dst.
+    //
+    void operator()(cv::Mat &dst)
+    {
+        dst.create(itsSrc.size(), itsSrc.type());
+        cv::parallel_for_(cv::Range(0, itsHeight), Splat(*this));
+        cv::parallel_for_(cv::Range(0, itsHeight), Blur(*this, false));
+        cv::parallel_for_(cv::Range(0, itsWidth), Blur(*this, true));
+        cv::parallel_for_(cv::Range(0, itsSrc.rows), Slice(*this, dst));
+    }
+
+    BilateralGrid(const cv::Mat &src, double sigmaColor, double sigmaSpace):
+        itsSrc(src),
+        itsSpace(std::max(double(minSpace), sigmaSpace)),
+        itsColor(std::max(double(minColor), sigmaColor))
+    {
+        CV_Assert(src.depth() == CV_8U && src.channels() <= 3);
+        if (src.channels() == 1) {
+            itsGray = src;
+        } else {
+            cv::cvtColor(src, itsGray, cv::COLOR_BGR2GRAY);
+        }
+        itsWidth = gridX(src.cols - 1) + 1 + pad;
+        itsHeight = gridY(src.rows - 1) + 1 + pad;
+        itsDepth = gridZ(255) + 1 + pad;
+        itsCells.assign(itsWidth * itsHeight * itsDepth, cv::Vec4f());
+        itsFirstRow.assign(itsHeight + 1, src.rows);
+        for (int y = src.rows - 1; y >= 0; --y) itsFirstRow[gridY(y)] = y;
+        for (int gy = itsHeight - 1; gy >= 0; --gy) {
+            itsFirstRow[gy] = std::min(itsFirstRow[gy], itsFirstRow[gy + 1]);
+        }
+    }
+};
+
+// Filter src into dst as cv::bilateralFilter(src, dst, d, sigmaColor,
+// sigmaSpace) does, but with a BilateralGrid when the sigmas are big
+// enough for one.
+//
+static void bilateralGridFilter(const cv::Mat &src, cv::Mat &dst, int d,
+                                double sigmaColor, double sigmaSpace)
+{
+    if (sigmaSpace < BilateralGrid::minSpace
+        || sigmaColor < BilateralGrid::minColor) {
+        cv::bilateralFilter(src, dst, d, sigmaColor, sigmaSpace);
+        return;
+    }
+    BilateralGrid filter(src, sigmaColor, sigmaSpace);
+    filter(dst);
+}
+
+static bool showBilateralBlur(const cv::Mat &src, bool grid = false)
+{
+    const char *const caption = grid
+        ? "Bilateral Grid Blur"
+        : "Bilateral Blur";
     if (displayCaption(src, caption)) return true;
     for (int i = 1; i < MAX_KERNEL_LENGTH; i += 2) {
         const int pixelNeighborhoodDiameter = i;
         const double sigmaColor = 2.0 * i;
         const double sigmaSpace = 0.5 * i;
         cv::Mat dst;
-        cv::bilateralFilter(src, dst, pixelNeighborhoodDiameter,
-                            sigmaColor, sigmaSpace);
+        if (grid) {
+            bilateralGridFilter(src, dst, pixelNeighborhoodDiameter,
+                                sigmaColor, sigmaSpace);
+        } else {
+            cv::bilateralFilter(src, dst, pixelNeighborhoodDiameter,
+                                sigmaColor, sigmaSpace);
+        }
         if (displayShort(dst, caption)) return true;
     }
     return false;
 }
 
+// Report the milliseconds cv::bilateralFilter() and BilateralGrid take on
+// src for each diameter of the showBilateralBlur() sweep, and the PSNR of
+// the grid result against the exact one.
+//
+static void timeBilateralSweeps(const cv::Mat &src)
+{
+    const double msPerTick = 1000.0 / cv::getTickFrequency();
+    for (int i = 1; i < MAX_KERNEL_LENGTH; i += 2) {
+        const double sigmaColor = 2.0 * i;
+        const double sigmaSpace = 0.5 * i;
+        cv::Mat expect, actual;
+        const int64 tickZero = cv::getTickCount();
+        cv::bilateralFilter(src, expect, i, sigmaColor, sigmaSpace);
+        const int64 tickOne = cv::getTickCount();
+        bilateralGridFilter(src, actual, i, sigmaColor, sigmaSpace);
+        const int64 tickTwo = cv::getTickCount();
+        std::cout << "Bilateral " << i << ": bilateralFilter() "
+                  << (tickOne - tickZero) * msPerTick << " ms, grid "
+                  << (tickTwo - tickOne) * msPerTick << " ms, PSNR "
+                  << cv::PSNR(expect, actual) << std::endl;
+    }
+}
+
 static bool showOriginal(const cv::Mat &src)
 {
     static const char caption[] = "Original Image";
@@ -129,17 +655,37 @@ static bool showOriginal(const cv::Mat &src)
 }
 
 
+// Report how long the various sweeps over src take without showing them.
+//
+static void reportTimes(const cv::Mat &src)
+{
+    std::cout << src.cols << "x" << src.rows << " image" << std::endl;
+    timeGaussianSweeps(src);
+    timeMedianSweeps(src);
+    timeBilateralSweeps(src);
+}
+
 int main(int ac, const char *av[])
 {
-    if (ac == 2) {
+    if (ac == 3 && std::string("bench") == av[2]) {
+        const cv::Mat src = cv::imread(av[1], 1);
+        if (!src.empty()) {
+            reportTimes(src);
+            return 0;
+        }
+    } else if (ac == 2) {
         const cv::Mat src = cv::imread(av[1], 1);
         if (!src.empty()) {
             const int stop
                 =  showOriginal(src)
                 || showHomogeneousBlur(src)
                 || showGaussianBlur(src)
+                || showScaleSpaceBlur(src, false)
+                || showScaleSpaceBlur(src, true)
                 || showMedianBlur(src)
+                || showMedianBlur(src, true)
                 || showBilateralBlur(src)
+                || showBilateralBlur(src, true)
                 || displayCaption(src, "End: Press a key!");
             if (stop) return 0;
             cv::waitKey(0);
@@ -148,9 +694,11 @@ int main(int ac, const char *av[])
     }
     std::cerr << av[0] << ": Demonstrate some blur filters."
               << std::endl << std::endl
-              << "Usage: " << av[0] << " <image-file>" << std::endl
+              << "Usage: " << av[0] << " <image-file> [bench]" << std::endl
               << std::endl
               << "Where: <image-file> is the name of an image file."
+              << std::endl
+              << "       bench reports filter times instead of showing them."
               << std::endl << std::endl
               << "Example: " << av[0] << " ../resources/lena.jpg"
               << std::endl << std::endl;
@@ -1,6 +1,11 @@
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 // Create a new unobscured named window for image.
@@ -28,25 +33,192 @@ static void makeWindow(const char *window, const cv::Mat &image, int reset = 0)
     maxY = std::max(maxY, image.rows);
 }
 
-// Return a normalized histogram across binCount bins for plane.
+// Count the pixels of an interleaved 8-bit 3-channel image, such as BGR
+// or HSV, into a 1-D histogram of 256 bins for each channel and
+// optionally into a 2-D histogram of two channels, all in one pass that
+// reads the image in place.
 //
-static cv::Mat_<float> normalizedHistogram(const cv::Mat &plane, int binCount)
+// Each stripe of rows counts into its own private bins, which are merged
+// only at the end, so threads never share a counter.  Within a stripe,
+// consecutive pixels count into COPIES copies of the bins in turn, so a
+// run of similar pixels does not stall each increment on the store to
+// the same bin just before it.  The 2-D bin of a pixel comes from a
+// lookup table per channel, as in cv::calcHist(), and values outside the
+// ranges count into spare bins past the end.
+//
+class HistogramEngine {
+
+    enum { CHANNELS = 3, COPIES = 4, VALUES = 256 };
+
+    int itsChannel[2];
+    int itsBins[2];
+    int itsTwoD;
+    std::vector<int> itsLut[2];
+
+    // Return a table mapping each value to step times its bin among bins
+    // over [0, max) as cv::calcHist() would, or to spare if it is outside.
+    //
+    static std::vector<int> lut(int bins, float max, int step, int spare)
+    {
+        std::vector<int> result(VALUES);
+        const double a = bins / double(max);
+        for (int v = 0; v < VALUES; ++v) {
+            const int i = cvFloor(v * a);
+            result[v] = unsigned(i) < unsigned(bins) ? i * step : spare;
+        }
+        return result;
+    }
+
+    // Return the number of private counters for a stripe.
+    //
+    int countersFor(bool twoD) const
+    {
+        return COPIES * (CHANNELS * VALUES + (twoD ? itsTwoD : 0));
+    }
+
+    // Count rows of image into counters: COPIES copies of the 1-D bins
+    // of each channel, then COPIES copies of the 2-D bins if twoD.
+    //
+    template <bool twoD>
+    void count(const cv::Mat &image, const cv::Range &rows, int *counters)
+        const
+    {
+        int *const two = counters + COPIES * CHANNELS * VALUES;
+        const int *const la = twoD ? &itsLut[0][0] : 0;
+        const int *const lb = twoD ? &itsLut[1][0] : 0;
+        const int a = itsChannel[0], b = itsChannel[1];
+        const int quads = image.cols / COPIES * COPIES;
+        for (int y = rows.start; y < rows.end; ++y) {
+            const uchar *p = image.ptr<uchar>(y);
+            const uchar *const quadEnd = p + CHANNELS * quads;
+            const uchar *const end = p + CHANNELS * image.cols;
+            for (; p < quadEnd; p += CHANNELS * COPIES) {
+                for (int k = 0; k < COPIES; ++k) {
+                    const uchar *const q = p + CHANNELS * k;
+                    int *const h = counters + CHANNELS * VALUES * k;
+                    ++h[q[0]];
+                    ++h[VALUES + q[1]];
+                    ++h[2 * VALUES + q[2]];
+                    if (twoD) ++two[itsTwoD * k + la[q[a]] + lb[q[b]]];
+                }
+            }
+            for (; p < end; p += CHANNELS) {
+                ++counters[p[0]];
+                ++counters[VALUES + p[1]];
+                ++counters[2 * VALUES + p[2]];
+                if (twoD) ++two[la[p[a]] + lb[p[b]]];
+            }
+        }
+    }
+
+    // Count some stripes of image in parallel.
+    //
+    struct Stripe: cv::ParallelLoopBody {
+        const HistogramEngine &engine;
+        const cv::Mat &image;
+        std::vector<std::vector<int> > &counters;
+        bool twoD;
+        void operator()(const cv::Range &range) const {
+            const int stripes = counters.size();
+            for (int s = range.start; s < range.end; ++s) {
+                const cv::Range rows(s * image.rows / stripes,
+                                     (s + 1) * image.rows / stripes);
+                int *const c = &counters[s][0];
+                if (twoD) {
+                    engine.count<true>(image, rows, c);
+                } else {
+                    engine.count<false>(image, rows, c);
+                }
+            }
+        }
+        Stripe(const HistogramEngine &e, const cv::Mat &i,
+               std::vector<std::vector<int> > &c, bool t):
+            engine(e), image(i), counters(c), twoD(t) {}
+    };
+
+public:
+
+    // Count image into the 1-D histogram oneD[c] of each channel c, and
+    // into the 2-D histogram at twoD if this engine counts one.  Return
+    // them as CV_32F like cv::calcHist(), so oneD[c] is 256 rows by 1.
+    //
+    void operator()(const cv::Mat &image, cv::Mat oneD[CHANNELS],
+                    cv::Mat *twoD = 0) const
+    {
+        CV_Assert(image.type() == CV_8UC3);
+        const bool withTwoD = twoD && itsTwoD;
+        const int threads = std::max(1, cv::getNumThreads());
+        const int stripes = std::max(1, std::min(image.rows, threads));
+        const int size = countersFor(withTwoD);
+        std::vector<std::vector<int> > counters(stripes,
+                                                std::vector<int>(size, 0));
+        const Stripe stripe(*this, image, counters, withTwoD);
+        cv::parallel_for_(cv::Range(0, stripes), stripe);
+        std::vector<int> total(counters[0]);
+        for (int s = 1; s < stripes; ++s) {
+            for (int i = 0; i < size; ++i) total[i] += counters[s][i];
+        }
+        for (int c = 0; c < CHANNELS; ++c) {
+            oneD[c].create(VALUES, 1, CV_32FC1);
+            float *const h = oneD[c].ptr<float>();
+            for (int v = 0; v < VALUES; ++v) {
+                int sum = 0;
+                for (int k = 0; k < COPIES; ++k) {
+                    sum += total[(CHANNELS * k + c) * VALUES + v];
+                }
+                h[v] = sum;
+            }
+        }
+        if (withTwoD) {
+            const int *const two = &total[COPIES * CHANNELS * VALUES];
+            twoD->create(itsBins[0], itsBins[1], CV_32FC1);
+            float *const h = twoD->ptr<float>();
+            for (int i = 0; i < itsBins[0] * itsBins[1]; ++i) {
+                int sum = 0;
+                for (int k = 0; k < COPIES; ++k) sum += two[itsTwoD * k + i];
+                h[i] = sum;
+            }
+        }
+    }
+
+    // Count only the 1-D histograms.
+    //
+    HistogramEngine(): itsTwoD(0)
+    {
+        itsChannel[0] = itsChannel[1] = 0;
+        itsBins[0] = itsBins[1] = 0;
+    }
+
+    // Also count a 2-D histogram of channels c0 and c1 in bins0 by bins1
+    // uniform bins over [0, max0) and [0, max1).
+    //
+    HistogramEngine(int c0, int bins0, float max0,
+                    int c1, int bins1, float max1)
+    {
+        CV_Assert(0 <= c0 && c0 < CHANNELS && 0 <= c1 && c1 < CHANNELS);
+        CV_Assert(bins0 > 0 && bins1 > 0 && max0 > 0 && max1 > 0);
+        const int spare = bins0 * bins1;
+        itsChannel[0] = c0;
+        itsChannel[1] = c1;
+        itsBins[0] = bins0;
+        itsBins[1] = bins1;
+        itsTwoD = 2 * spare + 1;
+        itsLut[0] = lut(bins0, max0, bins1, spare);
+        itsLut[1] = lut(bins1, max1, 1, spare);
+    }
+};
+
+// Return histogram normalized to [0, rows] for drawing.
+//
+static cv::Mat_<float> normalizedHistogram(const cv::Mat &histogram,
+                                           int rows)
 {
     static const cv::Mat noMask;
-    static const int     imageCount     = 1;
-    static const int     dimensionCount = 1;
-    static const int     binCounts[]    = { binCount };
-    static const float   histRange[]    = { 0, binCount };
-    static const float  *histRanges[]   = { histRange };
-    static const bool    uniform        = true;
-    static const bool    accumulate     = false;
-    cv::Mat_<float>      histogram, result;
-    cv::calcHist(&plane, imageCount, 0, noMask, histogram,
-                 dimensionCount, binCounts, histRanges, uniform, accumulate);
     static const double alpha = 0;
     static const int normKind = cv::NORM_MINMAX;
     static const int dtype = -1;
-    const double beta = plane.rows;
+    const double beta = rows;
+    cv::Mat_<float> result;
     cv::normalize(histogram, result, alpha, beta, normKind, dtype, noMask);
     return result;
 }
@@ -72,6 +244,9 @@ static void drawHistogram(cv::Mat &image,
 // Return a new image with a histogram of colors in image after displaying
 // each channel of image in a separate window.
 //
+// HistogramEngine counts image in place, so the planes are split out only
+// to show them.
+//
 static cv::Mat computeHistogram(const cv::Mat &image)
 {
     static const int max = std::numeric_limits<unsigned char>::max();
@@ -81,21 +256,96 @@ static cv::Mat computeHistogram(const cv::Mat &image)
         [GREEN] = { cv::Scalar(  0, max,   0), "green" },
         [RED]   = { cv::Scalar(  0,   0, max), "red"   }
     };
-    static const int binCount = 1 + max; // a bin for each of [0..max]
+    static const HistogramEngine engine;
     cv::Mat result = cv::Mat_<cv::Vec3b>::zeros(image.rows, image.cols);
-    cv::Mat plane[COLORCOUNT];
+    cv::Mat plane[COLORCOUNT], histogram[COLORCOUNT];
     cv::split(image, plane);
+    engine(image, histogram);
     for (int c = 0; c < COLORCOUNT; ++c) { // for each color ...
         makeWindow(color[c].name, plane[c]);
-        const cv::Mat_<float> hist = normalizedHistogram(plane[c], binCount);
+        const cv::Mat_<float> hist
+            = normalizedHistogram(histogram[c], image.rows);
         drawHistogram(result, hist, color[c].value);
     }
     return result;
 }
 
+// Time HistogramEngine against cv::calcHist() on image scaled to 4K UHD
+// and converted to HSV, counting a 1-D histogram of each channel and a
+// 2-D hue-saturation histogram.  Time cv::calcHist() both on the image in
+// place and on planes from cv::split() as computeHistogram() does.
+//
+static void benchmarkHistograms(const cv::Mat &image)
+{
+    static const cv::Size uhd(3840, 2160);
+    static const int runs = 20;
+    static const cv::Mat noMask;
+    static const int valueCount = 256;
+    static const float valueRange[] = { 0, valueCount };
+    static const float *valueRanges[] = { valueRange };
+    static const int hueBins = 30, satBins = 32;
+    static const int hueSatBins[] = { hueBins, satBins };
+    static const float hueRange[] = { 0, 180 };
+    static const float *hueSatRanges[] = { hueRange, valueRange };
+    static const int hueSat[] = { 0, 1 };
+    const double msPerTick = 1000.0 / cv::getTickFrequency() / runs;
+    cv::Mat bgr, hsv;
+    cv::resize(image, bgr, uhd);
+    cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+    const HistogramEngine engine(0, hueBins, 180, 1, satBins, valueCount);
+    cv::Mat oneD[3], twoD, calcOneD[3], calcTwoD, plane[3];
+    const int64 tickZero = cv::getTickCount();
+    for (int i = 0; i < runs; ++i) engine(hsv, oneD, &twoD);
+    const int64 tickOne = cv::getTickCount();
+    for (int i = 0; i < runs; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            cv::calcHist(&hsv, 1, &c, noMask, calcOneD[c], 1,
+                         &valueCount, valueRanges);
+        }
+        cv::calcHist(&hsv, 1, hueSat, noMask, calcTwoD, 2,
+                     hueSatBins, hueSatRanges);
+    }
+    const int64 tickTwo = cv::getTickCount();
+    for (int i = 0; i < runs; ++i) {
+        cv::split(hsv, plane);
+        for (int c = 0; c < 3; ++c) {
+            cv::calcHist(&plane[c], 1, 0, noMask, calcOneD[c], 1,
+                         &valueCount, valueRanges);
+        }
+        cv::calcHist(&hsv, 1, hueSat, noMask, calcTwoD, 2,
+                     hueSatBins, hueSatRanges);
+    }
+    const int64 tickThree = cv::getTickCount();
+    double difference = cv::norm(twoD, calcTwoD, cv::NORM_INF);
+    for (int c = 0; c < 3; ++c) {
+        difference = std::max(difference,
+                              cv::norm(oneD[c], calcOneD[c], cv::NORM_INF));
+    }
+    const double engineMs = (tickOne - tickZero) * msPerTick;
+    const double calcMs = (tickTwo - tickOne) * msPerTick;
+    const double splitMs = (tickThree - tickTwo) * msPerTick;
+    std::cout << std::fixed << std::setprecision(2)
+              << hsv.cols << "x" << hsv.rows << " HSV, 3 1-D and a "
+              << hueBins << "x" << satBins << " 2-D histogram:" << std::endl
+              << "    cv::calcHist() in place    " << calcMs << " ms"
+              << std::endl
+              << "    cv::split() and calcHist() " << splitMs << " ms"
+              << std::endl
+              << "    HistogramEngine            " << engineMs << " ms"
+              << " (" << calcMs / engineMs << "x)" << std::endl
+              << "    largest difference in any bin " << difference
+              << std::endl;
+}
+
 int main(int ac, const char *av[])
 {
-    if (ac == 2) {
+    if (ac == 3 && std::string("bench") == av[2]) {
+        const cv::Mat image = cv::imread(av[1]);
+        if (image.data) {
+            benchmarkHistograms(image);
+            return 0;
+        }
+    } else if (ac == 2) {
         const cv::Mat image = cv::imread(av[1]);
         if (image.data) {
             std::cout << av[0] << ": Press some key to quit." << std::endl;
@@ -108,11 +358,15 @@ int main(int ac, const char *av[])
     }
     std::cerr << av[0] << ": Demonstrate histogram equalization."
               << std::endl << std::endl
-              << "Usage: " << av[0] << " <image-file>" << std::endl
+              << "Usage: " << av[0] << " <image-file> [bench]" << std::endl
               << std::endl
               << "Where: <image-file> is the name of an image file."
+              << std::endl
+              << "       bench times histograms of <image-file> at 4K."
               << std::endl << std::endl
               << "Example: " << av[0] << " ../resources/lena.jpg"
+              << std::endl
+              << "Example: " << av[0] << " ../resources/lena.jpg bench"
               << std::endl << std::endl;
     return 1;
 }
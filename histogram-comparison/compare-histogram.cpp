@@ -1,8 +1,29 @@
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <string>
 #include <vector>
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
 
 // Create a new unobscured named window for image.
 // Reset windows layout with when reset is not 0.
@@ -118,6 +139,642 @@ static void showHistogramComparisons(int count,
     cv::waitKey(0);
 }
 
+// Return true if name ends in the extension of an image file.
+//
+static bool isImageFile(const std::string &name)
+{
+    static const char *const extensions[] = {
+        ".bmp", ".jpeg", ".jpg", ".pbm", ".pgm", ".png", ".ppm",
+        ".tif", ".tiff"
+    };
+    static const int count = sizeof extensions / sizeof extensions[0];
+    const size_t dot = name.rfind('.');
+    if (dot == std::string::npos) return false;
+    std::string extension = name.substr(dot);
+    for (size_t i = 0; i < extension.size(); ++i) {
+        extension[i] = std::tolower((unsigned char)extension[i]);
+    }
+    for (int i = 0; i < count; ++i) {
+        if (extension == extensions[i]) return true;
+    }
+    return false;
+}
+
+// Add to files the image files anywhere under directory.
+//
+static void findImageFiles(const std::string &directory,
+                           std::vector<std::string> &files)
+{
+    DIR *const dir = opendir(directory.c_str());
+    if (!dir) return;
+    while (const struct dirent *const entry = readdir(dir)) {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+        const std::string path = directory + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st)) continue;
+        if (S_ISDIR(st.st_mode)) {
+            findImageFiles(path, files);
+        } else if (S_ISREG(st.st_mode) && isImageFile(name)) {
+            files.push_back(path);
+        }
+    }
+    closedir(dir);
+}
+
+#if CV_SSE2
+// Widen the 16 bytes at p to 4 vectors of 4 floats in f.
+//
+static inline void widenBytes(const uchar *p, __m128 f[4])
+{
+    const __m128i z = _mm_setzero_si128();
+    const __m128i b = _mm_load_si128((const __m128i *)p);
+    const __m128i lo = _mm_unpacklo_epi8(b, z);
+    const __m128i hi = _mm_unpackhi_epi8(b, z);
+    f[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, z));
+    f[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, z));
+    f[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, z));
+    f[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, z));
+}
+
+// Return the sum of the 4 floats in v.
+//
+static inline float sumFloats(__m128 v)
+{
+    float f[4];
+    _mm_storeu_ps(f, v);
+    return f[0] + f[1] + f[2] + f[3];
+}
+#endif
+
+// Return the sum of q[j] * r[j] for j less than n, a multiple of 16,
+// where r is 16-byte aligned.
+//
+static float dotBytes(const float *q, const uchar *r, int n)
+{
+    int j = 0;
+    float result = 0.0f;
+#if CV_SSE2
+    __m128 sum = _mm_setzero_ps();
+    for (; j < n; j += 16) {
+        __m128 f[4];
+        widenBytes(r + j, f);
+        for (int k = 0; k < 4; ++k) {
+            const __m128 p = _mm_mul_ps(f[k], _mm_loadu_ps(q + j + 4 * k));
+            sum = _mm_add_ps(sum, p);
+        }
+    }
+    result = sumFloats(sum);
+#endif
+    for (; j < n; ++j) result += q[j] * r[j];
+    return result;
+}
+
+// Return the sum of w[j] * (q[j] - e[j])^2 for j less than n, a multiple
+// of 16, where e[j] is (r[j] / 255)^2 and r is 16-byte aligned.
+//
+static float chiSquareBytes(const float *q, const float *w, const uchar *r,
+                            int n)
+{
+    static const float scale = 1.0f / (255.0f * 255.0f);
+    int j = 0;
+    float result = 0.0f;
+#if CV_SSE2
+    const __m128 s = _mm_set1_ps(scale);
+    __m128 sum = _mm_setzero_ps();
+    for (; j < n; j += 16) {
+        __m128 f[4];
+        widenBytes(r + j, f);
+        for (int k = 0; k < 4; ++k) {
+            const __m128 e = _mm_mul_ps(_mm_mul_ps(f[k], f[k]), s);
+            const __m128 d = _mm_sub_ps(_mm_loadu_ps(q + j + 4 * k), e);
+            const __m128 wd = _mm_mul_ps(_mm_loadu_ps(w + j + 4 * k), d);
+            sum = _mm_add_ps(sum, _mm_mul_ps(wd, d));
+        }
+    }
+    result = sumFloats(sum);
+#endif
+    for (; j < n; ++j) {
+        const float d = q[j] - r[j] * r[j] * scale;
+        result += w[j] * d * d;
+    }
+    return result;
+}
+
+// A packed index of the histograms of many images from
+// calculateHistogram() in one memory-mapped file.
+//
+// The file is a Header, then the square roots of the bins of each
+// histogram scaled to bytes, stride bytes apiece, then the offset of the
+// file name of each image into the names, then the sum of the bins of
+// each histogram, then the NUL-terminated names.  Storing square roots
+// makes cv::HISTCMP_BHATTACHARYYA a dot product with the roots of the
+// query, and keeps precision in the small bins.  Everything a query
+// reads is contiguous and aligned for SIMD.
+//
+class HistogramIndex {
+
+    struct Header {
+        char magic[8];
+        int count, hueBins, satBins, stride, pad[2];
+    };
+
+    void *itsMapping;
+    size_t itsMappingSize;
+    int itsCount;
+    int itsBins;
+    int itsStride;
+    const uchar *itsRoots;
+    const int64 *itsOffsets;
+    const float *itsSums;
+    const char *itsNames;
+
+    HistogramIndex(const HistogramIndex &);
+    HistogramIndex &operator=(const HistogramIndex &);
+
+    // Return the bytes in a histogram record padded out for SIMD.
+    //
+    static int strideFor(int bins) { return (bins + 15) / 16 * 16; }
+
+    // The packed histograms of a few images decoded in parallel.
+    //
+    struct Decode: cv::ParallelLoopBody {
+        const std::vector<std::string> &files;
+        cv::Mat &roots;
+        std::vector<float> &sums;
+        std::vector<uchar> &ok;
+        void operator()(const cv::Range &range) const {
+            for (int i = range.start; i < range.end; ++i) {
+                const cv::Mat bgr = cv::imread(files[i]);
+                ok[i] = bgr.data != 0;
+                if (!ok[i]) continue;
+                cv::Mat hsv;
+                cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+                const cv::Mat h = calculateHistogram(hsv);
+                CV_Assert(h.isContinuous() && h.type() == CV_32FC1);
+                const float *const p = h.ptr<float>();
+                uchar *const r = roots.ptr<uchar>(i);
+                float sum = 0.0f;
+                for (size_t j = 0; j < h.total(); ++j) {
+                    r[j] = cv::saturate_cast<uchar>(255 * std::sqrt(p[j]));
+                    sum += r[j] * r[j];
+                }
+                sums[i] = sum / (255.0f * 255.0f);
+            }
+        }
+        Decode(const std::vector<std::string> &f, cv::Mat &r,
+               std::vector<float> &s, std::vector<uchar> &o):
+            files(f), roots(r), sums(s), ok(o) {}
+    };
+
+    // Rank some of the histograms against a query in parallel.
+    //
+    struct Rank: cv::ParallelLoopBody {
+        const HistogramIndex &index;
+        const std::vector<float> &q;
+        const std::vector<float> &w;
+        double sum;
+        int method;
+        std::vector<float> &distance;
+        void operator()(const cv::Range &range) const {
+            const int n = index.itsStride;
+            for (int i = range.start; i < range.end; ++i) {
+                const uchar *const r = index.itsRoots + size_t(i) * n;
+                if (method == cv::HISTCMP_CHISQR) {
+                    distance[i] = chiSquareBytes(&q[0], &w[0], r, n);
+                } else {
+                    const double s = sum * index.itsSums[i];
+                    const double d = dotBytes(&q[0], r, n)
+                        / (s > FLT_EPSILON ? std::sqrt(s) : 1.0);
+                    distance[i] = std::sqrt(std::max(1.0 - d, 0.0));
+                }
+            }
+        }
+        Rank(const HistogramIndex &i, const std::vector<float> &qs,
+             const std::vector<float> &ws, double s, int m,
+             std::vector<float> &d):
+            index(i), q(qs), w(ws), sum(s), method(m), distance(d) {}
+    };
+
+    // Order indexes into distance by increasing distance.
+    //
+    struct ByDistance {
+        const std::vector<float> &distance;
+        bool operator()(int a, int b) const {
+            return distance[a] < distance[b];
+        }
+        ByDistance(const std::vector<float> &d): distance(d) {}
+    };
+
+public:
+
+    // The rank of an image in the index.
+    //
+    struct Hit { double distance; const char *name; };
+
+    // Write an index of the histograms of the image files under directory
+    // to file.  Decode chunk images at a time in parallel.  Write a
+    // temporary file first so no reader ever sees half an index.  Return
+    // the number of images indexed or -1 on failure.
+    //
+    static int build(const std::string &directory, const std::string &file)
+    {
+        static const int chunk = 1024;
+        static const int hueBins = 50;
+        static const int satBins = 60;
+        std::vector<std::string> files;
+        findImageFiles(directory, files);
+        std::sort(files.begin(), files.end());
+        Header h;
+        std::memcpy(h.magic, "HSVIndex", sizeof h.magic);
+        h.count = 0;
+        h.hueBins = hueBins;
+        h.satBins = satBins;
+        h.stride = strideFor(hueBins * satBins);
+        h.pad[0] = h.pad[1] = 0;
+        const std::string temp = file + ".tmp";
+        std::ofstream os(temp.c_str(), std::ios::binary);
+        os.write((const char *)&h, sizeof h);
+        std::vector<int64> offsets;
+        std::vector<float> sums;
+        std::string names;
+        for (size_t first = 0; os && first < files.size(); first += chunk) {
+            const size_t last = std::min(files.size(), first + chunk);
+            const std::vector<std::string> some(files.begin() + first,
+                                                files.begin() + last);
+            const int n = some.size();
+            cv::Mat roots = cv::Mat::zeros(n, h.stride, CV_8UC1);
+            std::vector<float> s(n);
+            std::vector<uchar> ok(n);
+            cv::parallel_for_(cv::Range(0, n), Decode(some, roots, s, ok));
+            for (int i = 0; i < n; ++i) {
+                if (!ok[i]) continue;
+                os.write((const char *)roots.ptr<uchar>(i), h.stride);
+                offsets.push_back(names.size());
+                sums.push_back(s[i]);
+                names += some[i];
+                names += '\0';
+            }
+        }
+        h.count = sums.size();
+        if (h.count) {
+            os.write((const char *)&offsets[0], h.count * sizeof offsets[0]);
+            os.write((const char *)&sums[0], h.count * sizeof sums[0]);
+        }
+        os.write(names.data(), names.size());
+        os.seekp(0);
+        os.write((const char *)&h, sizeof h);
+        os.close();
+        if (os && 0 == std::rename(temp.c_str(), file.c_str())) {
+            return h.count;
+        }
+        std::remove(temp.c_str());
+        return -1;
+    }
+
+    // Return the count images nearest to the image hsv by method, either
+    // cv::HISTCMP_BHATTACHARYYA or cv::HISTCMP_CHISQR, nearest first.
+    // Compare with the histogram of hsv first as compareHist() would.
+    //
+    std::vector<Hit> query(const cv::Mat &hsv, int method, int count) const
+    {
+        const cv::Mat h = calculateHistogram(hsv);
+        CV_Assert(h.isContinuous() && int(h.total()) == itsBins);
+        const float *const p = h.ptr<float>();
+        std::vector<float> q(itsStride, 0.0f), w(itsStride, 0.0f);
+        double sum = 0.0;
+        for (int j = 0; j < itsBins; ++j) {
+            sum += p[j];
+            if (method == cv::HISTCMP_CHISQR) {
+                q[j] = p[j];
+                w[j] = p[j] ? 1.0f / p[j] : 0.0f;
+            } else {
+                q[j] = std::sqrt(p[j]) / 255.0f;
+            }
+        }
+        std::vector<float> distance(itsCount);
+        const Rank rank(*this, q, w, sum, method, distance);
+        cv::parallel_for_(cv::Range(0, itsCount), rank);
+        std::vector<int> order(itsCount);
+        for (int i = 0; i < itsCount; ++i) order[i] = i;
+        count = std::min(count, itsCount);
+        std::partial_sort(order.begin(), order.begin() + count, order.end(),
+                          ByDistance(distance));
+        std::vector<Hit> result(count);
+        for (int i = 0; i < count; ++i) {
+            result[i].distance = distance[order[i]];
+            result[i].name = itsNames + itsOffsets[order[i]];
+        }
+        return result;
+    }
+
+    // Return the number of images in the index.
+    //
+    int size() const { return itsCount; }
+
+    // Return true if the index file was mapped.
+    //
+    operator bool() const { return itsMapping != 0; }
+
+    ~HistogramIndex() { if (itsMapping) munmap(itsMapping, itsMappingSize); }
+
+    // Map the index in file, written earlier by build().
+    //
+    HistogramIndex(const std::string &file):
+        itsMapping(0), itsMappingSize(0), itsCount(0), itsBins(0),
+        itsStride(0), itsRoots(0), itsOffsets(0), itsSums(0), itsNames(0)
+    {
+        const int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (0 == fstat(fd, &st) && size_t(st.st_size) > sizeof(Header)) {
+            p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (p == MAP_FAILED) return;
+        const size_t size = st.st_size;
+        const Header &h = *(const Header *)p;
+        const size_t record
+            = size_t(h.stride) + sizeof *itsOffsets + sizeof *itsSums;
+        const size_t packed = sizeof h + h.count * record;
+        const char *const end = (const char *)p + size;
+        const bool ok
+            =  0 == std::memcmp(h.magic, "HSVIndex", sizeof h.magic)
+            && h.count >= 0 && h.hueBins > 0 && h.satBins > 0
+            && h.stride == strideFor(h.hueBins * h.satBins)
+            && packed <= size && (packed == size || end[-1] == '\0');
+        if (!ok) {
+            munmap(p, size);
+            return;
+        }
+        itsMapping = p;
+        itsMappingSize = size;
+        itsCount = h.count;
+        itsBins = h.hueBins * h.satBins;
+        itsStride = h.stride;
+        itsRoots = (const uchar *)p + sizeof h;
+        itsOffsets = (const int64 *)(itsRoots + size_t(itsCount) * itsStride);
+        itsSums = (const float *)(itsOffsets + itsCount);
+        itsNames = (const char *)(itsSums + itsCount);
+    }
+};
+
+// Index the histograms of the images under directory into file.
+//
+static bool buildIndex(const char *file, const char *directory)
+{
+    const int64 tickZero = cv::getTickCount();
+    const int count = HistogramIndex::build(directory, file);
+    const double seconds
+        = (cv::getTickCount() - tickZero) / cv::getTickFrequency();
+    if (count < 0) return false;
+    std::cout << "Indexed " << count << " images under " << directory
+              << " into " << file << " in " << seconds << " seconds."
+              << std::endl;
+    return true;
+}
+
+// Rank the images in the index in file by the distance of their
+// histograms from that of the image in query by method, and show the
+// nearest few.
+//
+static bool queryIndex(const char *file, const char *query, int method)
+{
+    static const int nearest = 10;
+    const HistogramIndex index(file);
+    const cv::Mat bgr = cv::imread(query);
+    if (!index || !bgr.data) return false;
+    cv::Mat hsv;
+    cv::cvtColor(bgr, hsv, cv::COLOR_BGR2HSV);
+    const int64 tickZero = cv::getTickCount();
+    const std::vector<HistogramIndex::Hit> hits
+        = index.query(hsv, method, nearest);
+    const double ms
+        = (cv::getTickCount() - tickZero) * 1000.0 / cv::getTickFrequency();
+    std::cout << std::fixed << std::setprecision(4);
+    for (size_t i = 0; i < hits.size(); ++i) {
+        std::cout << std::setw(4) << i + 1 << " " << hits[i].distance
+                  << " " << hits[i].name << std::endl;
+    }
+    std::cout << std::setprecision(2) << "Ranked " << index.size()
+              << " images in " << ms << " ms." << std::endl;
+    return true;
+}
+
+// Return the H-S histogram of a small copy of the frame bgr scaled to
+// sum to 1, so histograms of frames can be averaged.  Set brightness to
+// the mean Value of the frame.
+//
+static cv::Mat shotHistogram(const cv::Mat &bgr, double &brightness)
+{
+    static const int cols = 160;
+    const int rows = std::max(1, cvRound(bgr.rows * double(cols) / bgr.cols));
+    cv::Mat small, hsv;
+    cv::resize(bgr, small, cv::Size(cols, rows), 0, 0, cv::INTER_NEAREST);
+    cv::cvtColor(small, hsv, cv::COLOR_BGR2HSV);
+    brightness = cv::mean(hsv)[2];
+    cv::Mat result = calculateHistogram(hsv);
+    const double sum = cv::sum(result)[0];
+    if (sum > 0.0) result /= sum;
+    return result;
+}
+
+// Find the cuts and fades in a video from the histograms of its frames.
+//
+// A frame is a cut if its histogram is far from that of the frame just
+// before it.  Otherwise compare it with a running average of the
+// histograms since the last boundary.  A gradual transition pulls the
+// frames away from the average until it catches up again.  That span is
+// a fade if some frame in it got farther than fadeEnd from the average
+// where it started.
+//
+// Hue and Saturation are noise in frames too dark to have color, so
+// there are no cuts between two dark frames.  A fade through black is
+// one fade.
+//
+// Decode batch frames at a time on one thread while other threads
+// histogram the batch decoded before it.
+//
+class ShotDetector {
+
+    cv::VideoCapture itsVideo;
+    double itsFps;
+    int itsFrame;
+    int itsFadeStart;
+    double itsFarthest;
+    double itsBrightness;
+    cv::Mat itsPrevious;
+    cv::Mat itsAverage;
+    cv::Mat itsReference;
+
+    // Decode the next batch and histogram the current one at once.
+    //
+    struct Step: cv::ParallelLoopBody {
+        cv::VideoCapture &video;
+        std::vector<cv::Mat> &next;
+        int &decoded;
+        const std::vector<cv::Mat> &current;
+        int count;
+        std::vector<cv::Mat> &histograms;
+        std::vector<double> &brightness;
+        int workers;
+        void operator()(const cv::Range &range) const {
+            for (int s = range.start; s < range.end; ++s) {
+                if (s == 0) {
+                    decoded = 0;
+                    while (decoded < int(next.size())
+                           && video.read(next[decoded])) ++decoded;
+                } else {
+                    for (int i = s - 1; i < count; i += workers) {
+                        double &b = brightness[i];
+                        histograms[i] = shotHistogram(current[i], b);
+                    }
+                }
+            }
+        }
+        Step(cv::VideoCapture &v, std::vector<cv::Mat> &n, int &d,
+             const std::vector<cv::Mat> &c, int k, std::vector<cv::Mat> &h,
+             std::vector<double> &b, int w):
+            video(v), next(n), decoded(d), current(c), count(k),
+            histograms(h), brightness(b), workers(w) {}
+    };
+
+    // Return the time of frame in the video as HH:MM:SS.mmm.
+    //
+    std::string timeOf(int frame) const
+    {
+        const int ms = cvRound(1000.0 * frame / itsFps);
+        std::ostringstream oss;
+        oss << std::setfill('0') << std::setw(2) << ms / 3600000 << ":"
+            << std::setw(2) << ms / 60000 % 60 << ":"
+            << std::setw(2) << ms / 1000 % 60 << "."
+            << std::setw(3) << ms % 1000;
+        return oss.str();
+    }
+
+    // Print on os the fade from itsFadeStart to frame if it went farther
+    // than fadeEnd from itsReference.  Then there is no fade in progress.
+    //
+    void endFade(int frame, std::ostream &os)
+    {
+        static const double fadeEnd = 0.45;
+        if (itsFadeStart >= 0 && itsFarthest > fadeEnd) {
+            os << "fade " << timeOf(itsFadeStart) << " to "
+               << timeOf(frame) << " frames " << itsFadeStart << "-"
+               << frame << " (" << itsFarthest << ")" << std::endl;
+        }
+        itsFadeStart = -1;
+    }
+
+    // Classify the next frame by its histogram h and brightness, and
+    // print a line on os for any boundary it ends.
+    //
+    void classify(const cv::Mat &h, double brightness, std::ostream &os)
+    {
+        static const int method = cv::HISTCMP_BHATTACHARYYA;
+        static const double cut = 0.4;
+        static const double fadeStart = 0.3;
+        static const double dark = 32.0;
+        static const double weight = 0.1;
+        if (itsPrevious.empty()) {
+            h.copyTo(itsAverage);
+        } else {
+            const double previous = cv::compareHist(h, itsPrevious, method);
+            const double average = cv::compareHist(h, itsAverage, method);
+            const bool lit = brightness >= dark || itsBrightness >= dark;
+            if (previous > cut && lit) {
+                os << "cut  at " << timeOf(itsFrame) << " frame "
+                   << itsFrame << " (" << previous << ")" << std::endl;
+                h.copyTo(itsAverage);
+                itsFadeStart = -1;
+            } else {
+                if (itsFadeStart < 0 && average > fadeStart) {
+                    itsFadeStart = itsFrame;
+                    itsFarthest = 0.0;
+                    itsAverage.copyTo(itsReference);
+                }
+                if (itsFadeStart >= 0) {
+                    const double d = cv::compareHist(h, itsReference, method);
+                    itsFarthest = std::max(itsFarthest, d);
+                    if (average <= fadeStart) endFade(itsFrame, os);
+                }
+                cv::addWeighted(itsAverage, 1.0 - weight, h, weight, 0.0,
+                                itsAverage);
+            }
+        }
+        h.copyTo(itsPrevious);
+        itsBrightness = brightness;
+        ++itsFrame;
+    }
+
+public:
+
+    // Return the number of frames read so far.
+    //
+    int frames() const { return itsFrame; }
+
+    // Return the seconds of video in frames().
+    //
+    double seconds() const { return itsFrame / itsFps; }
+
+    // Print on os a line for each cut or fade in the video.
+    //
+    void operator()(std::ostream &os)
+    {
+        static const int batch = 64;
+        const int workers = std::max(1, cv::getNumThreads() - 1);
+        std::vector<cv::Mat> current(batch), next(batch), hist(batch);
+        std::vector<double> brightness(batch);
+        int count = 0, decoded = 0;
+        os << std::fixed << std::setprecision(3);
+        do {
+            const Step step(itsVideo, next, decoded, current, count, hist,
+                            brightness, workers);
+            cv::parallel_for_(cv::Range(0, 1 + workers), step);
+            for (int i = 0; i < count; ++i) {
+                classify(hist[i], brightness[i], os);
+            }
+            current.swap(next);
+            count = decoded;
+        } while (count > 0);
+        if (itsFrame > 0) endFade(itsFrame - 1, os);
+    }
+
+    // Return true if the video opened.
+    //
+    operator bool() const { return itsVideo.isOpened(); }
+
+    // Find the shots in the video in file.
+    //
+    ShotDetector(const char *file):
+        itsVideo(file), itsFps(itsVideo.get(cv::CAP_PROP_FPS)),
+        itsFrame(0), itsFadeStart(-1), itsFarthest(0.0),
+        itsBrightness(0.0)
+    {
+        if (!(itsFps > 0.0)) itsFps = 25.0;
+    }
+};
+
+// Print a timeline of the cuts and fades in the video in file, then how
+// much faster than real time that took.
+//
+static bool reportShots(const char *file)
+{
+    ShotDetector detect(file);
+    if (!detect) return false;
+    const int64 tickZero = cv::getTickCount();
+    detect(std::cout);
+    const double seconds
+        = (cv::getTickCount() - tickZero) / cv::getTickFrequency();
+    std::cout << std::setprecision(2) << detect.frames() << " frames, "
+              << detect.seconds() << " seconds of video in " << seconds
+              << " seconds, " << (seconds > 0 ? detect.seconds() / seconds
+                                  : 0.0)
+              << " times real time." << std::endl;
+    return true;
+}
+
 // Read three images (named "Goal", "Tst0" and "Tst1") from the command
 // line.  Copy the upper half of "Goal" to another image named "Half".
 // Compute their HSV histograms, then compare them and show results.
@@ -126,8 +783,19 @@ int main(int ac, const char *av[])
 {
     static const char *name[] = { "Goal", "Tst0", "Tst1", "Half" };
     static const int count = sizeof name / sizeof name[0];
-    bool ok = ac == count;
-    if (ok) {
+    const std::string mode = ac > 2 ? av[2] : "";
+    if (ac == 3 && mode == "shots") {
+        if (reportShots(av[1])) return 0;
+    } else if (ac == 4 && mode == "index") {
+        if (buildIndex(av[1], av[3])) return 0;
+    } else if ((ac == 4 || ac == 5) && mode == "query") {
+        const std::string kind = ac == 5 ? av[4] : "bhattacharyya";
+        const int method = kind == "chisqr"
+            ? cv::HISTCMP_CHISQR : cv::HISTCMP_BHATTACHARYYA;
+        const bool known = kind == "chisqr" || kind == "bhattacharyya";
+        if (known && queryIndex(av[1], av[3], method)) return 0;
+    } else if (ac == count) {
+        bool ok = true;
         cv::Mat bgr[count];
         for (int i = 0; ok && i < count - 1; ++i) {
             bgr[i] = cv::imread(av[1 + i]);
@@ -142,14 +810,36 @@ int main(int ac, const char *av[])
     std::cerr << av[0] << ": Demonstrate histogram comparison."
               << std::endl << std::endl
               << "Usage: " << av[0] << " <goal> <test0> <test1>" << std::endl
+              << "       " << av[0] << " <index> index <directory>"
+              << std::endl
+              << "       " << av[0] << " <index> query <image> [<method>]"
+              << std::endl
+              << "       " << av[0] << " <video> shots" << std::endl
               << std::endl
               << "Where: <goal>, <test0>, and <test1> are color images."
               << std::endl
               << "       <goal> is the image to which <test0> and <test0>"
               << std::endl
               << "              are compared."
+              << std::endl
+              << "       <index> is a histogram index file."
+              << std::endl
+              << "       index writes <index> for the images in <directory>."
+              << std::endl
+              << "       query ranks the images in <index> by <image>."
+              << std::endl
+              << "       <method> is bhattacharyya (the default) or chisqr."
+              << std::endl
+              << "       shots prints the cuts and fades in <video>."
               << std::endl << std::endl
               << "Example: " << av[0] << " ../resources/hand*.jpg"
+              << std::endl
+              << "Example: " << av[0] << " resources.index index ../resources"
+              << std::endl
+              << "Example: " << av[0] << " resources.index query"
+              << " ../resources/hand_sample1.jpg chisqr"
+              << std::endl
+              << "Example: " << av[0] << " ../resources/Megamind.avi shots"
               << std::endl << std::endl;
     return 1;
 }
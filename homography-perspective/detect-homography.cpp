@@ -1,8 +1,18 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/nonfree/features2d.hpp>
+#include <opencv2/video/tracking.hpp>
 
 static void showUsage(const char *av0)
 {
@@ -13,14 +23,41 @@ static void showUsage(const char *av0)
               << "to locate and outline an object in a scene." << std::endl
               << std::endl
               << "Usage: " << av0 << " <object> <scene>" << std::endl
+              << "       " << av0 << " <scene> catalogue <object> ..."
+              << std::endl
+              << "       " << av0 << " <object> <scene> ransac" << std::endl
+              << "       " << av0 << " <object> <video> track" << std::endl
               << std::endl
               << "Where: <object> and <scene> are image files." << std::endl
               << "       <object> has features present in <scene>." << std::endl
               << "       <scene> is where to search for features" << std::endl
               << "               from the <object> image." << std::endl
+              << "       <video> is a video file." << std::endl
+              << std::endl
+              << "The <object> features and their FLANN index are cached"
+              << std::endl
+              << "in *.features.* files in the current directory." << std::endl
+              << std::endl
+              << "The catalogue mode finds which of many <object> images"
+              << std::endl
+              << "appear in <scene> by searching one index of all of them."
+              << std::endl
+              << "The ransac mode compares PROSAC with cv::RANSAC on the"
+              << std::endl
+              << "matches of <object> in <scene> and on synthetic matches."
+              << std::endl
+              << "The track mode outlines <object> in frames of <video>,"
+              << std::endl
+              << "following its inliers by optical flow between detections."
+              << std::endl
               << std::endl
               << "Example: " << av0 << " ../resources/box.png"
               << " ../resources/box_in_scene.png" << std::endl
+              << "Example: " << av0 << " ../resources/box_in_scene.png"
+              << " catalogue ../resources/box.png ../resources/*.jpg"
+              << std::endl
+              << "Example: " << av0 << " ../resources/megamind-lamp.png"
+              << " ../resources/Megamind.avi track" << std::endl
               << std::endl;
 }
 
@@ -38,23 +75,178 @@ struct Features {
     Features(const cv::Mat &i): image(i) {}
 };
 
-// Return matches of object in scene.
+// Return a hex string of a 64-bit FNV-1a hash of tag and the pixels of
+// image, to name files caching what tag computes from image.
 //
-static Matches matchFeatures(Features &object, Features &scene)
+static std::string contentHash(const std::string &tag, const cv::Mat &image)
 {
-    static const int minHessian = 400;
-    cv::SurfFeatureDetector detector(minHessian);
-    detector.detect(object.image, object.keyPoints);
-    detector.detect(scene.image, scene.keyPoints);
-    cv::SurfDescriptorExtractor extractor;
-    extractor.compute(object.image, object.keyPoints, object.descriptors);
-    extractor.compute(scene.image, scene.keyPoints, scene.descriptors);
-    cv::FlannBasedMatcher matcher;
+    static const uint64 prime = 1099511628211ULL;
+    uint64 hash = 14695981039346656037ULL;
+    std::ostringstream oss;
+    oss << tag << " " << image.cols << "x" << image.rows << " "
+        << image.type();
+    const std::string s = oss.str();
+    for (int i = 0; i < s.size(); ++i) hash = (hash ^ uchar(s[i])) * prime;
+    const int bytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; ++y) {
+        const uchar *const p = image.ptr(y);
+        for (int i = 0; i < bytes; ++i) hash = (hash ^ p[i]) * prime;
+    }
+    std::ostringstream result;
+    result << std::hex << std::setfill('0') << std::setw(16) << hash;
+    return result.str();
+}
+
+// The keypoints, descriptors and trained FLANN index of an object image
+// cached in files named for its pixels and how its features were found.
+//
+class ObjectCache {
+
+    const std::string itsName;
+    const std::string itsTmp;
+
+public:
+
+    // Load object features from the cache.  Return true if they were there.
+    //
+    bool load(Features &object) const
+    {
+        cv::FileStorage fs(itsName + ".yml", cv::FileStorage::READ);
+        if (!fs.isOpened()) return false;
+        cv::read(fs["keyPoints"], object.keyPoints);
+        fs["descriptors"] >> object.descriptors;
+        return !object.descriptors.empty()
+            && object.descriptors.rows == object.keyPoints.size();
+    }
+
+    // Load object features and their index from the cache.
+    // Return true if they were there.
+    //
+    bool load(Features &object, cv::flann::Index &index) const
+    {
+        return load(object)
+            && index.load(object.descriptors, itsName + ".flann");
+    }
+
+    // Cache object features.
+    //
+    // Write a temporary file and rename it so load() never sees a partial
+    // cache.
+    //
+    void save(const Features &object) const
+    {
+        const std::string yml = itsName + ".yml";
+        const std::string tmp = itsTmp + ".yml";
+        cv::FileStorage fs(tmp, cv::FileStorage::WRITE);
+        cv::write(fs, "keyPoints", object.keyPoints);
+        fs << "descriptors" << object.descriptors;
+        fs.release();
+        std::rename(tmp.c_str(), yml.c_str());
+    }
+
+    // Cache object features and their index, the index first so load()
+    // never finds features without it.
+    //
+    void save(const Features &object, const cv::flann::Index &index) const
+    {
+        const std::string flann = itsName + ".flann";
+        const std::string tmp = itsTmp + ".flann";
+        index.save(tmp);
+        std::rename(tmp.c_str(), flann.c_str());
+        save(object);
+    }
+
+    // Return a temporary file name unique to writer.
+    //
+    static std::string tmpName(const std::string &name, int writer)
+    {
+        std::ostringstream oss;
+        oss << name << ".tmp" << writer;
+        return oss.str();
+    }
+
+    // Cache features computed by tag from image.  Concurrent savers of
+    // the same image need different writer numbers, so their temporary
+    // files do not collide.
+    //
+    ObjectCache(const std::string &tag, const cv::Mat &image,
+                int writer = 0):
+        itsName(contentHash(tag, image) + ".features"),
+        itsTmp(tmpName(itsName, writer))
+    {}
+};
+
+// Return a match for each scene descriptor to its nearest neighbor in
+// index of object descriptors.  As when matching object to scene, the
+// queryIdx is into object and the trainIdx is into scene.
+//
+static Matches searchIndex(cv::flann::Index &index, const Features &scene)
+{
+    static const int knn = 1;
     Matches result;
-    matcher.match(object.descriptors, scene.descriptors, result);
+    if (scene.descriptors.empty()) return result;
+    cv::Mat indices, dists;
+    index.knnSearch(scene.descriptors, indices, dists, knn);
+    for (int i = 0; i < indices.rows; ++i) {
+        const int o = indices.at<int>(i, 0);
+        if (o < 0) continue;
+        const float dist = dists.type() == CV_32S
+            ? dists.at<int>(i, 0) : std::sqrt(dists.at<float>(i, 0));
+        result.push_back(cv::DMatch(o, i, dist));
+    }
     return result;
 }
 
+// The Hessian threshold for SURF features.
+//
+static const int minHessian = 400;
+
+// Detect and describe SURF features in f.
+//
+static void findFeatures(Features &f)
+{
+    cv::SurfFeatureDetector detector(minHessian);
+    cv::SurfDescriptorExtractor extractor;
+    detector.detect(f.image, f.keyPoints);
+    extractor.compute(f.image, f.keyPoints, f.descriptors);
+}
+
+// Load or compute the features of object and index its descriptors.
+// Return false if object has no features.
+//
+// Index the object's descriptors instead of the scene's, so the object
+// side is cached whole and only the scene is described on each run.
+//
+static bool indexObject(Features &object, cv::flann::Index &index)
+{
+    std::ostringstream tag; tag << "SURF " << minHessian << " KDTree";
+    const ObjectCache cache(tag.str(), object.image);
+    const int64 tickZero = cv::getTickCount();
+    const bool cached = cache.load(object, index);
+    if (!cached) {
+        findFeatures(object);
+        if (object.descriptors.empty()) return false;
+        index.build(object.descriptors, cv::flann::KDTreeIndexParams());
+        cache.save(object, index);
+    }
+    const double ms = 1000.0 * (cv::getTickCount() - tickZero)
+        / cv::getTickFrequency();
+    std::cout << (cached ? "Loaded " : "Computed ")
+              << object.keyPoints.size() << " object features in "
+              << ms << " ms." << std::endl;
+    return true;
+}
+
+// Return matches of object in scene.
+//
+static Matches matchFeatures(Features &object, Features &scene)
+{
+    cv::flann::Index index;
+    if (!indexObject(object, index)) return Matches();
+    findFeatures(scene);
+    return searchIndex(index, scene);
+}
+
 // Return only good matches in matches.  A good match has distance less
 // than thrice the minimum distance.
 //
@@ -93,34 +285,338 @@ static cv::Mat drawMatches(Features &object, Features &scene,
     return result;
 }
 
+// Return the SPRT decision threshold A for models fitting a fraction
+// epsilon of points when good and delta when bad.  Fitting a model costs
+// about as much as checking fitCost points.
+//
+static double sprtThreshold(double epsilon, double delta)
+{
+    static const double fitCost = 200.0;
+    const double c = (1.0 - delta) * std::log((1.0 - delta) / (1.0 - epsilon))
+        + delta * std::log(delta / epsilon);
+    const double k = fitCost * c + 1.0;
+    double result = k;
+    for (int i = 0; i < 10; ++i) result = k + std::log(result);
+    return result;
+}
+
+// Estimate a homography from point matches ordered by quality with
+// PROSAC, verifying each hypothesis with Wald's SPRT.
+//
+// PROSAC draws its first samples from the best few matches and widens
+// the pool on a schedule that ends in RANSAC's uniform sampling, so a
+// good model usually turns up within a few iterations.  SPRT checks a
+// model against points in random order and rejects it once the odds of
+// a bad model pass A, so a bad model costs a few dozen checks instead of
+// all of them.  Each new best model is refit to its inliers by least
+// squares.  Stop when, for some n best matches with more inliers than
+// chance, a better model would have been sampled with probability
+// confidence.
+//
+class Prosac {
+
+    enum { sampleSize = 4, maxIterations = 20000 };
+
+    std::vector<cv::Point2f> itsFrom;
+    std::vector<cv::Point2f> itsTo;
+    std::vector<int> itsOrder;
+    std::vector<int> itsShuffle;
+    cv::RNG itsRng;
+    int itsIterations;
+    int itsRejected;
+    int itsChecks;
+
+    // Order indexes by increasing distance.
+    //
+    struct ByDistance {
+        const std::vector<float> &distance;
+        bool operator()(int a, int b) const
+        {
+            return distance[a] < distance[b];
+        }
+        ByDistance(const std::vector<float> &d): distance(d) {}
+    };
+
+    // Return true if h maps point i to within threshold of its match.
+    //
+    bool fits(const double *h, int i) const
+    {
+        static const double threshold = 3.0;
+        const cv::Point2f &p = itsFrom[i], &q = itsTo[i];
+        const double w = h[6] * p.x + h[7] * p.y + h[8];
+        if (std::fabs(w) < DBL_EPSILON) return false;
+        const double dx = (h[0] * p.x + h[1] * p.y + h[2]) / w - q.x;
+        const double dy = (h[3] * p.x + h[4] * p.y + h[5]) / w - q.y;
+        return dx * dx + dy * dy < threshold * threshold;
+    }
+
+    // Return the number of points h fits and set fit[i] for each.
+    //
+    int inliers(const cv::Mat &h, std::vector<uchar> &fit) const
+    {
+        const double *const p = h.ptr<double>();
+        int result = 0;
+        fit.resize(itsFrom.size());
+        for (int i = 0; i < fit.size(); ++i) result += fit[i] = fits(p, i);
+        return result;
+    }
+
+    // Set sample to sampleSize distinct points: the n-th best and others
+    // from the n - 1 best when grow, otherwise any of the n best.
+    //
+    void draw(int n, bool grow, int sample[sampleSize])
+    {
+        int count = 0;
+        if (grow) sample[count++] = n - 1;
+        const int pool = grow ? n - 1 : n;
+        while (count < sampleSize) {
+            const int s = itsRng.uniform(0, pool);
+            const int *const end = sample + count;
+            if (std::find(sample, end, s) == end) sample[count++] = s;
+        }
+    }
+
+    // Return true if the triangles of sample turn the same way among the
+    // from points as among the to points.  A homography cannot flip them.
+    //
+    bool orientable(const int sample[sampleSize]) const
+    {
+        static const int triangle[][3] = {
+            {0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3}
+        };
+        for (int t = 0; t < 4; ++t) {
+            const int a = sample[triangle[t][0]];
+            const int b = sample[triangle[t][1]];
+            const int c = sample[triangle[t][2]];
+            const double f
+                = (itsFrom[b] - itsFrom[a]).cross(itsFrom[c] - itsFrom[a]);
+            const double g = (itsTo[b] - itsTo[a]).cross(itsTo[c] - itsTo[a]);
+            if (f * g <= 0.0) return false;
+        }
+        return true;
+    }
+
+    // Return true unless SPRT with threshold a rejects h while checking
+    // points in random order.  Set checked to the points checked and
+    // fitted to those h fits.
+    //
+    bool verify(const double *h, double epsilon, double delta, double a,
+                int &checked, int &fitted)
+    {
+        const int n = itsFrom.size();
+        const double fit = delta / epsilon;
+        const double miss = (1.0 - delta) / (1.0 - epsilon);
+        const int start = itsRng.uniform(0, n);
+        double lambda = 1.0;
+        checked = fitted = 0;
+        while (checked < n) {
+            const int i = itsShuffle[(start + checked++) % n];
+            if (fits(h, i)) {
+                ++fitted;
+                lambda *= fit;
+            } else {
+                lambda *= miss;
+            }
+            if (lambda > a) return false;
+        }
+        return true;
+    }
+
+    // Refit h to the count points in fit by least squares while that
+    // adds inliers.  Return the new count.
+    //
+    int refine(cv::Mat &h, std::vector<uchar> &fit, int count) const
+    {
+        static const int rounds = 3;
+        for (int r = 0; r < rounds; ++r) {
+            std::vector<cv::Point2f> from, to;
+            for (int i = 0; i < fit.size(); ++i) {
+                if (fit[i]) {
+                    from.push_back(itsFrom[i]);
+                    to.push_back(itsTo[i]);
+                }
+            }
+            const cv::Mat g = cv::findHomography(from, to, 0);
+            if (g.empty()) break;
+            std::vector<uchar> more;
+            const int c = inliers(g, more);
+            if (c <= count) break;
+            h = g;
+            fit.swap(more);
+            count = c;
+        }
+        return count;
+    }
+
+    // Return the iterations after which samples from the n best points
+    // would have found a better model than the one fitting fit with
+    // probability confidence, for the n that makes that fewest.  Skip n
+    // where fit might be chance for a bad model fitting a fraction delta
+    // of points.  SPRT with threshold a rejects a good model with
+    // probability 1 / a.
+    //
+    int enough(const std::vector<uchar> &fit, double delta, double a) const
+    {
+        static const double confidence = 0.995;
+        static const double z = 3.0;
+        double result = maxIterations;
+        int count = 0;
+        for (int n = 1; n <= fit.size(); ++n) {
+            count += fit[n - 1];
+            if (n <= sampleSize) continue;
+            const double chance = delta * n + sampleSize
+                + z * std::sqrt(n * delta * (1.0 - delta));
+            if (count < chance) continue;
+            const double good = std::pow(double(count) / n, int(sampleSize))
+                * (1.0 - 1.0 / a);
+            const double k = good < 1.0
+                ? std::log(1.0 - confidence) / std::log(1.0 - good) : 0.0;
+            result = std::min(result, k);
+        }
+        return std::ceil(result);
+    }
+
+public:
+
+    // Return the iterations, SPRT rejections and point checks of the
+    // last estimate.
+    //
+    int iterations() const { return itsIterations; }
+    int rejected()   const { return itsRejected; }
+    int checks()     const { return itsChecks; }
+
+    // Return a homography from the from points to the to points, or an
+    // empty cv::Mat if none is found.  Set mask[i] for the inliers.
+    //
+    cv::Mat operator()(std::vector<uchar> &mask)
+    {
+        const int n = itsFrom.size();
+        mask.assign(n, 0);
+        itsIterations = itsRejected = itsChecks = 0;
+        cv::Mat best;
+        if (n < sampleSize) return best;
+        double epsilon = 0.02, delta = 0.01, deltaSum = 0.0;
+        double a = sprtThreshold(epsilon, delta);
+        std::vector<uchar> bestFit;
+        int bestCount = 0, limit = maxIterations;
+        double tn = maxIterations;
+        for (int i = 0; i < sampleSize; ++i) {
+            tn *= double(sampleSize - i) / (n - i);
+        }
+        int pool = sampleSize, tnPrime = 1;
+        while (itsIterations < limit) {
+            ++itsIterations;
+            if (itsIterations > tnPrime && pool < n) {
+                const double next = tn * (pool + 1) / (pool + 1 - sampleSize);
+                tnPrime += int(std::ceil(next - tn));
+                tn = next;
+                ++pool;
+            }
+            int sample[sampleSize];
+            draw(pool, tnPrime >= itsIterations, sample);
+            if (!orientable(sample)) continue;
+            cv::Point2f from[sampleSize], to[sampleSize];
+            for (int i = 0; i < sampleSize; ++i) {
+                from[i] = itsFrom[sample[i]];
+                to[i] = itsTo[sample[i]];
+            }
+            cv::Mat h = cv::getPerspectiveTransform(from, to);
+            int checked = 0, fitted = 0;
+            const bool good
+                = verify(h.ptr<double>(), epsilon, delta, a, checked, fitted);
+            itsChecks += checked;
+            if (!good) {
+                ++itsRejected;
+                deltaSum += double(fitted) / checked;
+                const double mean = deltaSum / itsRejected;
+                const double d
+                    = std::max(0.001, std::min(0.5 * epsilon, mean));
+                if (std::fabs(d - delta) > 0.05 * delta) {
+                    delta = d;
+                    a = sprtThreshold(epsilon, delta);
+                }
+            } else if (fitted > bestCount) {
+                std::vector<uchar> fit;
+                const int count = refine(h, fit, inliers(h, fit));
+                best = h;
+                bestFit.swap(fit);
+                bestCount = count;
+                epsilon = std::min(0.99, std::max(epsilon, double(count) / n));
+                a = sprtThreshold(epsilon, delta);
+                limit = std::max(itsIterations, enough(bestFit, delta, a));
+            }
+        }
+        for (int i = 0; i < bestFit.size(); ++i) {
+            if (bestFit[i]) mask[itsOrder[i]] = 1;
+        }
+        return best;
+    }
+
+    // Estimate homographies from from to to where distance[i] measures
+    // how bad a match from[i] is to to[i].
+    //
+    Prosac(const std::vector<cv::Point2f> &from,
+           const std::vector<cv::Point2f> &to,
+           const std::vector<float> &distance):
+        itsOrder(from.size()), itsShuffle(from.size()),
+        itsIterations(0), itsRejected(0), itsChecks(0)
+    {
+        for (int i = 0; i < itsOrder.size(); ++i) {
+            itsOrder[i] = itsShuffle[i] = i;
+        }
+        const ByDistance byDistance(distance);
+        std::stable_sort(itsOrder.begin(), itsOrder.end(), byDistance);
+        for (int i = 0; i < itsOrder.size(); ++i) {
+            itsFrom.push_back(from[itsOrder[i]]);
+            itsTo.push_back(to[itsOrder[i]]);
+        }
+        for (int i = int(itsShuffle.size()) - 1; i > 0; --i) {
+            std::swap(itsShuffle[i], itsShuffle[itsRng.uniform(0, i + 1)]);
+        }
+    }
+};
+
 // Find the best homography between the object image and the scene image
-// based on the features in matches.
+// based on the features in matches, trying the closest matches first.
 //
 static cv::Mat findHomography(Features &object, Features &scene,
                               const Matches &matches)
 {
+    std::vector<float> distance;
     for (int i = 0; i < matches.size(); ++i) {
         const cv::DMatch &m = matches[i];
         object.locations.push_back(object.keyPoints[m.queryIdx].pt);
         scene.locations.push_back(scene.keyPoints[m.trainIdx].pt);
+        distance.push_back(m.distance);
     }
-    return cv::findHomography(object.locations, scene.locations, cv::RANSAC);
+    Prosac prosac(object.locations, scene.locations, distance);
+    std::vector<uchar> mask;
+    return prosac(mask);
+}
+
+// Return the corners of an image of size clockwise from the origin.
+//
+static std::vector<cv::Point2f> cornersOf(const cv::Size &size)
+{
+    std::vector<cv::Point2f> result;
+    result.push_back(cv::Point2f(0, 0));
+    result.push_back(cv::Point2f(size.width, 0));
+    result.push_back(cv::Point2f(size.width, size.height));
+    result.push_back(cv::Point2f(0, size.height));
+    return result;
 }
 
 // Use homography to map corners of the object object to corners in the scene
-// based on the features in matches.
+// based on the features in matches.  Return no corners if no homography
+// fits the matches.
 //
 static std::vector<cv::Point2f> findCorners(Features &object, Features &scene,
                                             const Matches &matches)
 {
     const cv::Mat homography = findHomography(object, scene, matches);
+    if (homography.empty()) return std::vector<cv::Point2f>();
     const int x = object.image.size().width;
-    const int y = object.image.size().height;
-    std::vector<cv::Point2f> corners;
-    corners.push_back(cv::Point2f(0, 0));
-    corners.push_back(cv::Point2f(x, 0));
-    corners.push_back(cv::Point2f(x, y));
-    corners.push_back(cv::Point2f(0, y));
+    const std::vector<cv::Point2f> corners = cornersOf(object.image.size());
     std::vector<cv::Point2f> result(corners.size());
     cv::perspectiveTransform(corners, result, homography);
     const cv::Point2f offset(x, 0);
@@ -128,9 +624,600 @@ static std::vector<cv::Point2f> findCorners(Features &object, Features &scene,
     return result;
 }
 
+// Draw the outline through corner on image in color.
+//
+static void drawOutline(cv::Mat &image, const std::vector<cv::Point2f> &corner,
+                        const cv::Scalar &color)
+{
+    static const int thickness = 4;
+    for (int i = 0; i < corner.size(); ++i) {
+        const int j = (i + 1) % corner.size();
+        cv::line(image, corner[i], corner[j], color, thickness);
+    }
+}
+
+// A catalogue of object images to find in scenes.
+//
+// Index the descriptors of all objects together, with a side table of
+// the object owning each descriptor.  Each scene feature votes for the
+// owner of its nearest neighbor when that beats the second nearest by
+// ratio.  Only the objects with the most votes get a homography fitted
+// by Prosac.  A KD-tree search costs about the log of the number of
+// descriptors, so a scene costs little more to check against thousands
+// of objects than against a few.
+//
+class Catalogue {
+
+public:
+
+    // An object found in a scene with its votes, RANSAC inliers, and
+    // corners in the scene.
+    //
+    struct Found {
+        int object;
+        int votes;
+        int inliers;
+        std::vector<cv::Point2f> corners;
+    };
+
+private:
+
+    // The name and size of an object image, with its features.  Its
+    // descriptors move to the rows of itsDescriptors from first.
+    //
+    struct Entry {
+        std::string name;
+        cv::Size size;
+        std::vector<cv::KeyPoint> keyPoints;
+        cv::Mat descriptors;
+        int first;
+    };
+
+    std::vector<Entry> itsEntries;
+    std::vector<int> itsOwner;
+    cv::Mat itsDescriptors;
+    cv::flann::Index itsIndex;
+    bool itsOk;
+
+    // Return the tag for ObjectCache to name files caching features or
+    // the catalogue index.
+    //
+    static std::string tag(const char *kind)
+    {
+        std::ostringstream result;
+        result << "SURF " << minHessian << " " << kind;
+        return result.str();
+    }
+
+    // Find or load from the cache the features of the entries in range.
+    // Clear ok[i] if the image of entry i cannot be read.
+    //
+    struct Load: cv::ParallelLoopBody {
+        std::vector<Entry> &entries;
+        std::vector<uchar> &ok;
+        void operator()(const cv::Range &range) const {
+            for (int i = range.start; i < range.end; ++i) {
+                Entry &e = entries[i];
+                Features f(cv::imread(e.name, cv::IMREAD_GRAYSCALE));
+                ok[i] = f.image.data != 0;
+                if (!ok[i]) continue;
+                const ObjectCache cache(tag("KDTree"), f.image, i);
+                if (!cache.load(f)) {
+                    findFeatures(f);
+                    cache.save(f);
+                }
+                e.size = f.image.size();
+                e.keyPoints = f.keyPoints;
+                e.descriptors = f.descriptors;
+            }
+        }
+        Load(std::vector<Entry> &e, std::vector<uchar> &o):
+            entries(e), ok(o) {}
+    };
+
+    // Fit a homography to the votes for each object found in range.
+    //
+    struct Verify: cv::ParallelLoopBody {
+        const std::vector<Entry> &entries;
+        const std::vector<Matches> &votes;
+        const std::vector<cv::KeyPoint> &scene;
+        std::vector<Found> &found;
+        void operator()(const cv::Range &range) const {
+            for (int i = range.start; i < range.end; ++i) {
+                Found &f = found[i];
+                const Entry &e = entries[f.object];
+                const Matches &m = votes[f.object];
+                std::vector<cv::Point2f> from, to;
+                std::vector<float> distance;
+                for (int j = 0; j < m.size(); ++j) {
+                    from.push_back(e.keyPoints[m[j].queryIdx].pt);
+                    to.push_back(scene[m[j].trainIdx].pt);
+                    distance.push_back(m[j].distance);
+                }
+                std::vector<uchar> mask;
+                Prosac prosac(from, to, distance);
+                const cv::Mat h = prosac(mask);
+                if (h.empty()) continue;
+                f.inliers = cv::countNonZero(mask);
+                cv::perspectiveTransform(cornersOf(e.size), f.corners, h);
+            }
+        }
+        Verify(const std::vector<Entry> &e, const std::vector<Matches> &v,
+               const std::vector<cv::KeyPoint> &s, std::vector<Found> &f):
+            entries(e), votes(v), scene(s), found(f) {}
+    };
+
+    static bool moreVotes(const Found &a, const Found &b)
+    {
+        return a.votes > b.votes;
+    }
+
+    static bool moreInliers(const Found &a, const Found &b)
+    {
+        return a.inliers > b.inliers;
+    }
+
+    // Gather the descriptors of all entries into itsDescriptors, then
+    // load or build and cache the index of them.
+    //
+    void index()
+    {
+        int total = 0, cols = 0, type = CV_32F;
+        for (int i = 0; i < itsEntries.size(); ++i) {
+            Entry &e = itsEntries[i];
+            e.first = total;
+            if (e.descriptors.empty()) continue;
+            total += e.descriptors.rows;
+            cols = e.descriptors.cols;
+            type = e.descriptors.type();
+        }
+        itsOk = total > 0;
+        if (!itsOk) return;
+        itsDescriptors.create(total, cols, type);
+        itsOwner.resize(total);
+        for (int i = 0; i < itsEntries.size(); ++i) {
+            Entry &e = itsEntries[i];
+            if (e.descriptors.empty()) continue;
+            const cv::Range rows(e.first, e.first + e.descriptors.rows);
+            e.descriptors.copyTo(itsDescriptors.rowRange(rows));
+            std::fill(itsOwner.begin() + rows.start,
+                      itsOwner.begin() + rows.end, i);
+            e.descriptors.release();
+        }
+        const std::string flann
+            = contentHash(tag("Catalogue"), itsDescriptors)
+            + ".features.flann";
+        if (!itsIndex.load(itsDescriptors, flann)) {
+            itsIndex.build(itsDescriptors, cv::flann::KDTreeIndexParams());
+            itsIndex.save(flann + ".tmp");
+            std::rename((flann + ".tmp").c_str(), flann.c_str());
+        }
+    }
+
+public:
+
+    // Return the number of objects in this catalogue.
+    //
+    int size() const { return itsEntries.size(); }
+
+    // Return the number of descriptors indexed in this catalogue.
+    //
+    int descriptors() const { return itsDescriptors.rows; }
+
+    // Return the name of object.
+    //
+    const std::string &name(int object) const
+    {
+        return itsEntries[object].name;
+    }
+
+    // Return the objects found in scene, most inliers first.
+    //
+    std::vector<Found> operator()(Features &scene)
+    {
+        static const float ratio = 0.8;
+        static const int minVotes = 8;
+        static const int maxCandidates = 8;
+        static const int minInliers = 10;
+        std::vector<Found> result;
+        findFeatures(scene);
+        if (!itsOk || scene.descriptors.empty()) return result;
+        const int knn = std::min(2, itsDescriptors.rows);
+        cv::Mat indices, dists;
+        itsIndex.knnSearch(scene.descriptors, indices, dists, knn);
+        std::vector<Matches> votes(itsEntries.size());
+        for (int i = 0; i < indices.rows; ++i) {
+            const int n = indices.at<int>(i, 0);
+            if (n < 0) continue;
+            const float d = dists.at<float>(i, 0);
+            const bool distinct
+                = knn < 2 || d < ratio * ratio * dists.at<float>(i, 1);
+            if (distinct) {
+                const int o = itsOwner[n];
+                const int q = n - itsEntries[o].first;
+                votes[o].push_back(cv::DMatch(q, i, std::sqrt(d)));
+            }
+        }
+        std::vector<Found> found;
+        for (int o = 0; o < votes.size(); ++o) {
+            if (votes[o].size() >= minVotes) {
+                Found f;
+                f.object = o;
+                f.votes = votes[o].size();
+                f.inliers = 0;
+                found.push_back(f);
+            }
+        }
+        std::sort(found.begin(), found.end(), moreVotes);
+        if (found.size() > maxCandidates) found.resize(maxCandidates);
+        const Verify verify(itsEntries, votes, scene.keyPoints, found);
+        cv::parallel_for_(cv::Range(0, found.size()), verify);
+        for (int i = 0; i < found.size(); ++i) {
+            if (found[i].inliers >= minInliers) result.push_back(found[i]);
+        }
+        std::sort(result.begin(), result.end(), moreInliers);
+        return result;
+    }
+
+    // Return true if some object in this catalogue has features.
+    //
+    operator bool() const { return itsOk; }
+
+    // Catalogue the objects in image files.
+    //
+    Catalogue(const std::vector<std::string> &files):
+        itsEntries(files.size()), itsOk(false)
+    {
+        std::vector<uchar> ok(files.size());
+        for (int i = 0; i < files.size(); ++i) itsEntries[i].name = files[i];
+        cv::parallel_for_(cv::Range(0, files.size()), Load(itsEntries, ok));
+        for (int i = 0; i < files.size(); ++i) {
+            if (!ok[i]) {
+                std::cerr << "Cannot read " << files[i] << std::endl;
+                return;
+            }
+        }
+        index();
+    }
+};
+
+// Show where objects in the catalogue of image files appear in the scene
+// image in file.
+//
+static bool reportCatalogue(const char *file,
+                            const std::vector<std::string> &files)
+{
+    Features scene(cv::imread(file, cv::IMREAD_GRAYSCALE));
+    if (!scene.image.data) return false;
+    const double ms = 1000.0 / cv::getTickFrequency();
+    int64 tickZero = cv::getTickCount();
+    Catalogue catalogue(files);
+    if (!catalogue) return false;
+    std::cout << std::endl << "Indexed " << catalogue.descriptors()
+              << " descriptors of " << catalogue.size() << " objects in "
+              << ms * (cv::getTickCount() - tickZero) << " ms."
+              << std::endl;
+    tickZero = cv::getTickCount();
+    const std::vector<Catalogue::Found> found = catalogue(scene);
+    std::cout << "Searched " << scene.keyPoints.size()
+              << " scene features in "
+              << ms * (cv::getTickCount() - tickZero) << " ms."
+              << std::endl << std::endl
+              << " Votes Inliers Object" << std::endl;
+    static const cv::Scalar green(0, 255, 0);
+    cv::Mat image;
+    cv::cvtColor(scene.image, image, cv::COLOR_GRAY2BGR);
+    for (int i = 0; i < found.size(); ++i) {
+        const Catalogue::Found &f = found[i];
+        const std::string &name = catalogue.name(f.object);
+        std::cout << std::setw(6) << f.votes << std::setw(8) << f.inliers
+                  << " " << name << std::endl;
+        drawOutline(image, f.corners, green);
+        cv::putText(image, name.substr(name.find_last_of('/') + 1),
+                    f.corners[0], cv::FONT_HERSHEY_SIMPLEX, 0.5, green);
+    }
+    std::cout << std::endl << "Press any key to quit." << std::endl;
+    cv::imshow("Catalogue objects found", image);
+    cv::waitKey(0);
+    return true;
+}
+
+// Track a planar object through the frames of a video by homography.
+//
+// Match SURF features to find the object only in the first frame and
+// after losing it.  In between, follow the scene points of the inliers
+// of the last homography into each frame with pyramidal Lucas-Kanade
+// optical flow, and refit the homography to those tracks with Prosac,
+// trying the tracks with the least flow error first.  Tracks that stop
+// fitting are dropped, and features are matched again only when fewer
+// than minInliers remain.  Most frames then cost a pyramid and the flow
+// of a few hundred points, however large the frame is.
+//
+class PlanarTracker {
+
+    enum { minInliers = 12, level = 3 };
+
+    cv::flann::Index &itsIndex;         // of the object's descriptors
+    const Features &itsObject;          // whose descriptors are indexed
+    std::vector<cv::Point2f> itsFrom;   // object points tracked
+    std::vector<cv::Point2f> itsTo;     // where they were in last frame
+    std::vector<cv::Mat> itsPyramid;    // of the last frame
+    cv::Mat itsHomography;              // from object to last frame
+    int itsDetections;                  // count of feature matching
+
+    // The window of the Lucas-Kanade optical flow at each level.
+    //
+    static const cv::Size &winSize()
+    {
+        static const cv::Size result(21, 21);
+        return result;
+    }
+
+    // Fit a homography to the tracks from itsFrom to itsTo ordered by
+    // distance, and keep only the tracks of its inliers.  Return true
+    // if at least minInliers tracks remain.
+    //
+    bool fit(const std::vector<float> &distance)
+    {
+        std::vector<uchar> mask;
+        Prosac prosac(itsFrom, itsTo, distance);
+        itsHomography = prosac(mask);
+        int count = 0;
+        for (int i = 0; i < mask.size(); ++i) {
+            if (mask[i]) {
+                itsFrom[count] = itsFrom[i];
+                itsTo[count] = itsTo[i];
+                ++count;
+            }
+        }
+        itsFrom.resize(count);
+        itsTo.resize(count);
+        return !itsHomography.empty() && count >= minInliers;
+    }
+
+    // Find the object in gray by matching features with the index.
+    //
+    bool detect(const cv::Mat &gray)
+    {
+        ++itsDetections;
+        Features scene(gray);
+        findFeatures(scene);
+        const Matches matches = searchIndex(itsIndex, scene);
+        std::vector<float> distance;
+        itsFrom.clear();
+        itsTo.clear();
+        for (int i = 0; i < matches.size(); ++i) {
+            const cv::DMatch &m = matches[i];
+            itsFrom.push_back(itsObject.keyPoints[m.queryIdx].pt);
+            itsTo.push_back(scene.keyPoints[m.trainIdx].pt);
+            distance.push_back(m.distance);
+        }
+        return fit(distance);
+    }
+
+    // Follow the tracks from the last frame into the frame of pyramid.
+    //
+    bool follow(const std::vector<cv::Mat> &pyramid)
+    {
+        static const cv::TermCriteria termCrit
+            (cv::TermCriteria::COUNT | cv::TermCriteria::EPS, 20, 0.03);
+        std::vector<cv::Point2f> next;
+        std::vector<uchar> status;
+        std::vector<float> error;
+        cv::calcOpticalFlowPyrLK(itsPyramid, pyramid, itsTo, next,
+                                 status, error, winSize(), level, termCrit);
+        std::vector<float> distance;
+        int count = 0;
+        for (int i = 0; i < status.size(); ++i) {
+            if (status[i]) {
+                itsFrom[count] = itsFrom[i];
+                itsTo[count] = next[i];
+                distance.push_back(error[i]);
+                ++count;
+            }
+        }
+        itsFrom.resize(count);
+        itsTo.resize(count);
+        return count >= minInliers && fit(distance);
+    }
+
+public:
+
+    // Return the homography from the object to the last frame, which is
+    // empty unless the object was found there.
+    //
+    const cv::Mat &homography() const { return itsHomography; }
+
+    // Return how many times features were matched.
+    //
+    int detections() const { return itsDetections; }
+
+    // Return true if the object is found in gray, the next frame.
+    //
+    bool operator()(const cv::Mat &gray)
+    {
+        std::vector<cv::Mat> pyramid;
+        cv::buildOpticalFlowPyramid(gray, pyramid, winSize(), level);
+        const bool tracking = itsTo.size() >= minInliers;
+        const bool found = (tracking && follow(pyramid)) || detect(gray);
+        itsPyramid.swap(pyramid);
+        if (!found) {
+            itsHomography.release();
+            itsFrom.clear();
+            itsTo.clear();
+        }
+        return found;
+    }
+
+    // Track object whose descriptors are in index.
+    //
+    PlanarTracker(const Features &object, cv::flann::Index &index):
+        itsIndex(index), itsObject(object), itsDetections(0)
+    {}
+};
+
+// Outline object in each frame of the video in file as PlanarTracker
+// finds it.  Report the time tracking took per frame and how many frames
+// needed features matched.
+//
+static bool trackObject(Features &object, const char *file)
+{
+    cv::VideoCapture video(file);
+    if (!video.isOpened()) return false;
+    cv::flann::Index index;
+    if (!indexObject(object, index)) return false;
+    PlanarTracker track(object, index);
+    static const cv::Scalar green(0, 255, 0);
+    const std::vector<cv::Point2f> corner = cornersOf(object.image.size());
+    const double msPerTick = 1000.0 / cv::getTickFrequency();
+    cv::Mat frame;
+    cv::Size size;
+    int64 ticks = 0;
+    int count = 0, found = 0;
+    std::cout << std::endl << "Press q to quit." << std::endl << std::endl;
+    while (video.read(frame)) {
+        size = frame.size();
+        cv::Mat gray;
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+        const int64 tickZero = cv::getTickCount();
+        const bool hit = track(gray);
+        ticks += cv::getTickCount() - tickZero;
+        ++count;
+        if (hit) {
+            ++found;
+            std::vector<cv::Point2f> outline(corner.size());
+            cv::perspectiveTransform(corner, outline, track.homography());
+            drawOutline(frame, outline, green);
+        }
+        cv::imshow("Planar Tracking", frame);
+        if ('q' == cv::waitKey(1)) break;
+    }
+    std::cout << count << " frames of " << size.width << "x" << size.height
+              << ", found in " << found << " with " << track.detections()
+              << " detections, " << (count ? ticks * msPerTick / count
+                                         : 0.0)
+              << " ms per frame" << std::endl;
+    return true;
+}
+
+// Set from, to and distance to count matches of points in a 320x320
+// square to their images under a fixed homography.  Move all but a
+// fraction inliers of them to random places in a 640x480 scene, and give
+// those worse distances on average, as real matches tend to have.
+// Return the number of inliers.
+//
+static int syntheticMatches(int count, double inliers, cv::RNG &rng,
+                            std::vector<cv::Point2f> &from,
+                            std::vector<cv::Point2f> &to,
+                            std::vector<float> &distance)
+{
+    static const double h[] = {
+        0.9, 0.1, 40.0, -0.08, 1.1, 30.0, 1e-4, 2e-4, 1.0
+    };
+    static const double noise = 0.7;
+    int result = 0;
+    from.clear();
+    to.clear();
+    distance.clear();
+    for (int i = 0; i < count; ++i) {
+        const cv::Point2f p(rng.uniform(0.0, 320.0), rng.uniform(0.0, 320.0));
+        const bool inlier = rng.uniform(0.0, 1.0) < inliers;
+        const double w = h[6] * p.x + h[7] * p.y + h[8];
+        cv::Point2f q(rng.uniform(0.0, 640.0), rng.uniform(0.0, 480.0));
+        if (inlier) {
+            q.x = (h[0] * p.x + h[1] * p.y + h[2]) / w + rng.gaussian(noise);
+            q.y = (h[3] * p.x + h[4] * p.y + h[5]) / w + rng.gaussian(noise);
+        }
+        from.push_back(p);
+        to.push_back(q);
+        distance.push_back(rng.uniform(0.0, 1.0) + (inlier ? 0.0 : 0.4));
+        result += inlier;
+    }
+    return result;
+}
+
+// Print the iterations, SPRT rejections, point checks, time and inliers
+// of Prosac and the time and inliers of cv::findHomography() with
+// cv::RANSAC, which does not report its iterations, estimating the
+// homography from from to to.
+//
+static void compareRansac(const std::string &what,
+                          const std::vector<cv::Point2f> &from,
+                          const std::vector<cv::Point2f> &to,
+                          const std::vector<float> &distance)
+{
+    static const double threshold = 3.0;
+    const double tickMs = 1000.0 / cv::getTickFrequency();
+    std::vector<uchar> mask;
+    int64 tickZero = cv::getTickCount();
+    const cv::Mat h
+        = cv::findHomography(from, to, cv::RANSAC, threshold, mask);
+    const double ransacMs = tickMs * (cv::getTickCount() - tickZero);
+    const int ransacInliers = h.empty() ? 0 : cv::countNonZero(mask);
+    Prosac prosac(from, to, distance);
+    tickZero = cv::getTickCount();
+    const cv::Mat g = prosac(mask);
+    const double prosacMs = tickMs * (cv::getTickCount() - tickZero);
+    const int prosacInliers = g.empty() ? 0 : cv::countNonZero(mask);
+    std::cout << std::endl << what << ": " << from.size() << " matches"
+              << std::endl
+              << "     Method  Iterations  Rejected  Checks      ms"
+              << "  Inliers" << std::endl << std::fixed
+              << std::setprecision(2)
+              << " cv::RANSAC" << std::setw(12) << "-" << std::setw(10)
+              << "-" << std::setw(8) << "-" << std::setw(8) << ransacMs
+              << std::setw(9) << ransacInliers << std::endl
+              << "     PROSAC" << std::setw(12) << prosac.iterations()
+              << std::setw(10) << prosac.rejected()
+              << std::setw(8) << prosac.checks()
+              << std::setw(8) << prosacMs
+              << std::setw(9) << prosacInliers << std::endl;
+}
+
+// Compare Prosac with cv::RANSAC on the matches of object in scene, then
+// on synthetic matches with more and more outliers.
+//
+static void benchmarkRansac(Features &object, Features &scene)
+{
+    static const struct { int count; double inliers; } set[] = {
+        { 500, 0.5 }, { 1000, 0.1 }, { 2000, 0.05 }, { 2000, 0.03 }
+    };
+    static const int setCount = sizeof set / sizeof set[0];
+    const Matches matches = matchFeatures(object, scene);
+    std::vector<cv::Point2f> from, to;
+    std::vector<float> distance;
+    for (int i = 0; i < matches.size(); ++i) {
+        from.push_back(object.keyPoints[matches[i].queryIdx].pt);
+        to.push_back(scene.keyPoints[matches[i].trainIdx].pt);
+        distance.push_back(matches[i].distance);
+    }
+    compareRansac("Object to scene", from, to, distance);
+    cv::RNG rng;
+    for (int i = 0; i < setCount; ++i) {
+        const int inliers = syntheticMatches(set[i].count, set[i].inliers,
+                                             rng, from, to, distance);
+        std::ostringstream what;
+        what << "Synthetic with " << inliers << " inliers";
+        compareRansac(what.str(), from, to, distance);
+    }
+}
+
 int main(int ac, char *av[])
 {
-    if (ac == 3) {
+    if (ac > 3 && std::string(av[2]) == "catalogue") {
+        const std::vector<std::string> files(av + 3, av + ac);
+        if (reportCatalogue(av[1], files)) return 0;
+    } else if (ac == 4 && std::string(av[3]) == "ransac") {
+        Features  object(cv::imread(av[1], cv::IMREAD_GRAYSCALE));
+        Features scene(cv::imread(av[2], cv::IMREAD_GRAYSCALE));
+        if (object.image.data && scene.image.data) {
+            benchmarkRansac(object, scene);
+            return 0;
+        }
+    } else if (ac == 4 && std::string(av[3]) == "track") {
+        Features object(cv::imread(av[1], cv::IMREAD_GRAYSCALE));
+        if (object.image.data && trackObject(object, av[2])) return 0;
+    } else if (ac == 3) {
         Features  object(cv::imread(av[1], cv::IMREAD_GRAYSCALE));
         Features scene(cv::imread(av[2], cv::IMREAD_GRAYSCALE));
         if (object.image.data && scene.image.data) {
@@ -142,11 +1229,11 @@ int main(int ac, char *av[])
             const std::vector<cv::Point2f> corner
                 = findCorners(object, scene, good);
             static const cv::Scalar green(0, 255, 0);
-            static const int thickness = 4;
-            cv::line(image, corner[0], corner[1], green, thickness);
-            cv::line(image, corner[1], corner[2], green, thickness);
-            cv::line(image, corner[2], corner[3], green, thickness);
-            cv::line(image, corner[3], corner[0], green, thickness);
+            if (corner.empty()) {
+                std::cerr << av[0] << ": Object not found."
+                          << std::endl << std::endl;
+            }
+            drawOutline(image, corner, green);
             cv::imshow("Good Matches & Object detection", image);
             cv::waitKey(0);
             return 0;
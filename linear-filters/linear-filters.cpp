@@ -1,6 +1,11 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <vector>
 
 
 // Return a normalized box filter kernel of size i for filter2D().
@@ -25,6 +30,200 @@ static cv::Mat applyFilter(const cv::Mat &src, const cv::Mat &kernel)
     return result;
 }
 
+// Apply kernels to one image src as applyFilter() does, but by
+// multiplying spectra instead of by filter2D() when a kernel is at least
+// crossover on a side.
+//
+// The spectra of src are cached by kernel size, which determines the
+// border added to src and the DFT size, so applying several kernels of
+// the same size to src in a row transforms src only once.  Only the two
+// most recent sizes are kept, since each costs a few padded planes the
+// size of src, and a sweep through kernel sizes never returns to older
+// ones.  The spectra of kernels are cached by kernel content and DFT
+// size for the life of the program, so applying a kernel to several
+// images transforms the kernel only once.
+//
+class FilterEngine {
+
+    typedef std::pair<int, int> SizeKey;
+    typedef std::vector<cv::Mat> Planes;
+    typedef std::pair<SizeKey, Planes> ImageSpectrum;
+
+    // Identify a kernel and the DFT size its spectrum is padded out to.
+    //
+    struct KernelKey {
+        size_t hash;
+        int rows, cols, dftRows, dftCols;
+        bool operator<(const KernelKey &k) const {
+            if (hash != k.hash) return hash < k.hash;
+            if (rows != k.rows) return rows < k.rows;
+            if (cols != k.cols) return cols < k.cols;
+            if (dftRows != k.dftRows) return dftRows < k.dftRows;
+            return dftCols < k.dftCols;
+        }
+    };
+
+    // A kernel and its spectrum padded out to some DFT size.
+    //
+    struct KernelSpectrum { cv::Mat kernel; cv::Mat spectrum; };
+    typedef std::map<KernelKey, KernelSpectrum> KernelSpectra;
+
+    const cv::Mat itsSrc;
+    const int itsCrossover;
+    std::vector<ImageSpectrum> itsImageSpectra;     // most recent first
+
+    static KernelSpectra &kernelSpectra(void)
+    {
+        static KernelSpectra result;
+        return result;
+    }
+
+    // Return an FNV-1a hash of the bytes of the continuous kernel k.
+    //
+    static size_t hash(const cv::Mat &k)
+    {
+        size_t result = 2166136261u;
+        const size_t count = k.total() * k.elemSize();
+        for (size_t i = 0; i < count; ++i) {
+            result = (result ^ k.data[i]) * 16777619u;
+        }
+        return result;
+    }
+
+    // Return the DFT size for correlating src with a kernel of size k.
+    //
+    cv::Size dftSize(const cv::Size &k) const
+    {
+        const int cols = cv::getOptimalDFTSize(itsSrc.cols + k.width - 1);
+        const int rows = cv::getOptimalDFTSize(itsSrc.rows + k.height - 1);
+        return cv::Size(cols, rows);
+    }
+
+    // Return the spectra of the planes of src with the border a kernel
+    // of size k needs, padded out to dftSize(k).
+    //
+    const Planes &imageSpectra(const cv::Size &k)
+    {
+        static const size_t maxCount = 2;
+        const SizeKey key(k.width, k.height);
+        std::vector<ImageSpectrum>::iterator it = itsImageSpectra.begin();
+        while (it != itsImageSpectra.end() && it->first != key) ++it;
+        if (it != itsImageSpectra.end()) {
+            std::rotate(itsImageSpectra.begin(), it, it + 1);
+            return itsImageSpectra.front().second;
+        }
+        if (itsImageSpectra.size() >= maxCount) itsImageSpectra.pop_back();
+        itsImageSpectra.insert(itsImageSpectra.begin(),
+                               ImageSpectrum(key, Planes()));
+        Planes &result = itsImageSpectra.front().second;
+        const int top = k.height / 2, bottom = k.height - 1 - top;
+        const int left = k.width / 2, right = k.width - 1 - left;
+        const cv::Size size = dftSize(k);
+        cv::Mat bordered;
+        cv::copyMakeBorder(itsSrc, bordered, top, bottom, left, right,
+                           cv::BORDER_REFLECT_101);
+        bordered.convertTo(bordered, CV_32F);
+        cv::split(bordered, result);
+        for (size_t c = 0; c < result.size(); ++c) {
+            cv::copyMakeBorder(result[c], result[c],
+                               0, size.height - bordered.rows,
+                               0, size.width - bordered.cols,
+                               cv::BORDER_CONSTANT, cv::Scalar::all(0));
+            cv::dft(result[c], result[c], 0, bordered.rows);
+        }
+        return result;
+    }
+
+    // Return the spectrum of kernel k padded out to dftSize(k.size()).
+    //
+    const cv::Mat &kernelSpectrum(const cv::Mat_<float> &k)
+    {
+        static const size_t maxCount = 64;
+        const cv::Size size = dftSize(k.size());
+        const KernelKey key = {
+            hash(k), k.rows, k.cols, size.height, size.width
+        };
+        KernelSpectra &spectra = kernelSpectra();
+        KernelSpectra::iterator it = spectra.find(key);
+        const bool hit = it != spectra.end()
+            && 0 == std::memcmp(it->second.kernel.data, k.data,
+                                k.total() * k.elemSize());
+        if (hit) return it->second.spectrum;
+        if (spectra.size() >= maxCount) spectra.clear();
+        KernelSpectrum &entry = spectra[key];
+        entry.kernel = k.clone();
+        cv::copyMakeBorder(k, entry.spectrum,
+                           0, size.height - k.rows, 0, size.width - k.cols,
+                           cv::BORDER_CONSTANT, cv::Scalar::all(0));
+        cv::dft(entry.spectrum, entry.spectrum, 0, k.rows);
+        return entry.spectrum;
+    }
+
+public:
+
+    // The kernel side length at which multiplying spectra usually beats
+    // filter2D() on an image of a few hundred pixels on a side.
+    //
+    static const int defaultCrossover = 15;
+
+    // True if this applies kernel by multiplying spectra.
+    //
+    bool usesDft(const cv::Mat &kernel) const
+    {
+        return std::min(kernel.rows, kernel.cols) >= itsCrossover;
+    }
+
+    // Return kernel applied to src as applyFilter(src, kernel) would.
+    //
+    cv::Mat operator()(const cv::Mat &kernel)
+    {
+        if (!usesDft(kernel)) return applyFilter(itsSrc, kernel);
+        cv::Mat_<float> k;
+        kernel.convertTo(k, CV_32F);
+        const Planes &image = imageSpectra(k.size());
+        const cv::Mat &spectrum = kernelSpectrum(k);
+        const cv::Rect crop(0, 0, itsSrc.cols, itsSrc.rows);
+        static const int inverse
+            = cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT;
+        Planes planes(image.size());
+        for (size_t c = 0; c < image.size(); ++c) {
+            static const bool conjugate = true;
+            cv::Mat product;
+            cv::mulSpectrums(image[c], spectrum, product, 0, conjugate);
+            cv::dft(product, product, inverse, itsSrc.rows);
+            product(crop).convertTo(planes[c], itsSrc.depth());
+        }
+        cv::Mat result;
+        cv::merge(planes, result);
+        return result;
+    }
+
+    FilterEngine(const cv::Mat &src, int crossover = defaultCrossover):
+        itsSrc(src), itsCrossover(crossover)
+    {}
+};
+
+// Return the milliseconds taken to call f(kernel) and store it in dst.
+//
+template <typename F>
+static double timeFilter(F &f, const cv::Mat &kernel, cv::Mat &dst)
+{
+    const int64 tickZero = cv::getTickCount();
+    dst = f(kernel);
+    const int64 ticks = cv::getTickCount() - tickZero;
+    return 1000.0 * ticks / cv::getTickFrequency();
+}
+
+// Apply kernel to src with filter2D() through applyFilter().
+//
+struct Filter2d {
+    const cv::Mat &src;
+    cv::Mat operator()(const cv::Mat &kernel) const {
+        return applyFilter(src, kernel);
+    }
+    Filter2d(const cv::Mat &s): src(s) {}
+};
+
 int main(int ac, const char *av[])
 {
     if (ac == 2) {
@@ -32,9 +231,19 @@ int main(int ac, const char *av[])
         if (src.data) {
             cv::namedWindow("filter2d() demo", cv::WINDOW_AUTOSIZE);
             std::cout << av[0] << ": Press some key to quit." << std::endl;
+            const Filter2d filter2d(src);
+            FilterEngine engine(src);
             for (int i = 0; i < std::numeric_limits<int>::max(); ++i) {
                 const cv::Mat kernel = makeKernel(i);
-                const cv::Mat dst = applyFilter(src, kernel);
+                cv::Mat expect, dst;
+                const double ms2d = timeFilter(filter2d, kernel, expect);
+                const double msEngine = timeFilter(engine, kernel, dst);
+                std::cout << kernel.cols << "x" << kernel.rows
+                          << " filter2D(): " << ms2d << " ms, engine "
+                          << (engine.usesDft(kernel) ? "DFT" : "spatial")
+                          << ": " << msEngine << " ms, max diff "
+                          << cv::norm(expect, dst, cv::NORM_INF)
+                          << std::endl;
                 cv::imshow("filter2d() demo", dst);
                 const int c = cv::waitKey(500);
                 if (c != -1) break;
@@ -1,6 +1,9 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc.hpp>
+#include <cmath>
 #include <iostream>
+#include <string>
+#include <vector>
 
 
 // Create a new unobscured named window for image.
@@ -74,6 +77,83 @@ struct CvVideoCapture: cv::VideoCapture {
 };
 
 
+// The log-polar transform parameters used on every frame.
+//
+static const double logPolarMagnitude = 40;
+static const int logPolarFlags = cv::WARP_FILL_OUTLIERS;
+
+
+// Do what cv::logPolar() does without recomputing its sampling maps on
+// every call.
+//
+// The maps are computed once into the fixed-point form cv::remap() uses,
+// and recomputed only when the frame size, center, magnitude, or flags
+// change.  Each call is then just one cv::remap(), which already splits
+// its rows across threads with parallel_for_().
+//
+class LogPolarMap {
+
+    cv::Size itsSize;
+    cv::Point2f itsCenter;
+    double itsMagnitude;
+    int itsFlags;
+    cv::Mat itsXY;
+    cv::Mat itsA;
+
+    // Sample at exp(rho / magnitude) from center along angle phi, where
+    // rho is a column and phi is a row scaled to 2 pi radians.
+    //
+    void compute(void)
+    {
+        const int rows = itsSize.height;
+        const int cols = itsSize.width;
+        std::vector<float> r(cols);
+        for (int rho = 0; rho < cols; ++rho) {
+            r[rho] = std::exp(rho / itsMagnitude);
+        }
+        cv::Mat_<float> mapX(itsSize), mapY(itsSize);
+        for (int phi = 0; phi < rows; ++phi) {
+            const double angle = phi * 2 * CV_PI / rows;
+            const float cp = std::cos(angle);
+            const float sp = std::sin(angle);
+            float *const x = mapX[phi];
+            float *const y = mapY[phi];
+            for (int rho = 0; rho < cols; ++rho) {
+                x[rho] = r[rho] * cp + itsCenter.x;
+                y[rho] = r[rho] * sp + itsCenter.y;
+            }
+        }
+        const bool nearest = cv::INTER_NEAREST == interpolation();
+        cv::convertMaps(mapX, mapY, itsXY, itsA, CV_16SC2, nearest);
+    }
+
+    int interpolation(void) const { return itsFlags & cv::INTER_MAX; }
+
+public:
+
+    // Transform src into dst as cv::logPolar() would.
+    //
+    void operator()(const cv::Mat &src, cv::Mat &dst,
+                    const cv::Point2f &center, double magnitude, int flags)
+    {
+        const bool same
+            =  src.size() == itsSize && center == itsCenter
+            && magnitude == itsMagnitude && flags == itsFlags;
+        if (!same) {
+            itsSize = src.size();
+            itsCenter = center;
+            itsMagnitude = magnitude;
+            itsFlags = flags;
+            compute();
+        }
+        cv::remap(src, dst, itsXY, itsA, interpolation(),
+                  cv::BORDER_CONSTANT, cv::Scalar());
+    }
+
+    LogPolarMap(): itsMagnitude(0), itsFlags(0) {}
+};
+
+
 // Play video from file transformed by cv::logPolar() with title at FPS or
 // by stepping frames using a trackbar as a scrub control.
 //
@@ -86,6 +166,7 @@ class PlayWithLogPolar {
     const cv::Size frameSize;
     cv::Mat frame;
     cv::Mat logPolarFrame;
+    LogPolarMap logPolar;
     int position;
     enum State { RUN, STEP } state;
 
@@ -95,13 +176,12 @@ class PlayWithLogPolar {
         static const int halfCols = frameSize.width  / 2;
         static const int halfRows = frameSize.height / 2;
         static const cv::Point2f center(halfCols, halfRows);
-        static const double magnitude = 40;
-        static const int flags = cv::WARP_FILL_OUTLIERS;
         video >> frame;
         if (frame.data) {
             position = video.getPosition();
             cv::setTrackbarPos("Position", title, position);
-            cv::logPolar(frame, logPolarFrame, center, magnitude, flags);
+            logPolar(frame, logPolarFrame, center,
+                     logPolarMagnitude, logPolarFlags);
             cv::imshow(title, frame);
             cv::imshow("Log Polar", logPolarFrame);
         }
@@ -160,9 +240,51 @@ public:
 };
 
 
+// Report the frames per second of cv::logPolar() and of LogPolarMap on
+// every frame of the video in file without showing anything.
+//
+static bool compareFps(const char *file)
+{
+    CvVideoCapture video(file);
+    if (!video.isOpened()) return false;
+    LogPolarMap logPolar;
+    cv::Mat frame, builtinFrame, cachedFrame;
+    int64 builtinTicks = 0, cachedTicks = 0;
+    int frames = 0;
+    double maxDiff = 0.0;
+    while (video.read(frame)) {
+        const cv::Point2f center(frame.cols / 2, frame.rows / 2);
+        const int64 tickZero = cv::getTickCount();
+        cv::logPolar(frame, builtinFrame, center,
+                     logPolarMagnitude, logPolarFlags);
+        const int64 tickOne = cv::getTickCount();
+        logPolar(frame, cachedFrame, center,
+                 logPolarMagnitude, logPolarFlags);
+        const int64 tickTwo = cv::getTickCount();
+        builtinTicks += tickOne - tickZero;
+        cachedTicks += tickTwo - tickOne;
+        maxDiff = std::max(maxDiff, cv::norm(builtinFrame, cachedFrame,
+                                             cv::NORM_INF));
+        ++frames;
+    }
+    const double frequency = cv::getTickFrequency();
+    std::cout << file << ": " << frames << " frames" << std::endl
+              << "cv::logPolar() fps: "
+              << frames * frequency / std::max(builtinTicks, int64(1))
+              << std::endl
+              << "LogPolarMap    fps: "
+              << frames * frequency / std::max(cachedTicks, int64(1))
+              << std::endl
+              << "Largest pixel difference: " << maxDiff << std::endl;
+    return true;
+}
+
+
 int main(int ac, const char *av[])
 {
-    if (ac == 2) {
+    if (ac == 3 && std::string("fps") == av[2]) {
+        if (compareFps(av[1])) return 0;
+    } else if (ac == 2) {
         PlayWithLogPolar play(av[1]);
         if (play) {
             std::cout << std::endl
@@ -177,9 +299,11 @@ int main(int ac, const char *av[])
     }
     std::cerr << av[0] << ": Show a video with scrubber control." << std::endl
               << std::endl
-              << "Usage: " << av[0] << " <video-file>" << std::endl
+              << "Usage: " << av[0] << " <video-file> [fps]" << std::endl
               << std::endl
               << "Where: <video-file> is a video file." << std::endl
+              << "       fps compares cv::logPolar() frame rates"
+              << " without showing video." << std::endl
               << std::endl
               << "Example: " << av[0] << " ../resources/Megamind.avi"
               << std::endl << std::endl;
@@ -1,7 +1,18 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
-#include <iostream>
 #include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 // Create a new unobscured named window for image.
@@ -45,37 +56,184 @@ static bool waitSeconds(int seconds)
 //
 //    dst(x, y) = src(m.itsX(x, y), m.itsY(x, y))
 //
-// where ImageMap::init(m) calls m.computeXandYmaps(i, j) once for all rows
-// i and all columns j to initialize m.itsX and m.itsY.
+// where ImageMap::init(m) calls m.computeXandYmaps(i, x, y) once for each
+// row i to fill the row pointers x and y into m.itsX and m.itsY.  Keep the
+// per-row loops simple so the compiler can vectorize them.
+//
+// Then init() converts the float maps to the fixed-point CV_16SC2 and
+// interpolation table pair that convertMaps() produces, which is what
+// cv::remap() uses internally anyway, so operator() skips converting
+// them on every call.
+//
+// After ImageMap::useCache(directory), init() saves the fixed-point maps
+// in a file named for n and s in directory, and later maps of the same
+// name and size mmap() that file instead of computing anything.  Then
+// the float maps are recovered from the fixed-point maps only if some
+// ComposedMap needs them.
 //
 class ImageMap {
 
-    const char *itsName;
+    std::string itsName;
+    cv::Size itsSize;
+    void *itsMapping;
+    size_t itsMappingSize;
+
+    virtual void computeXandYmaps(int i, float *x, float *y) = 0;
+
+    ImageMap(const ImageMap &);
+    ImageMap &operator=(const ImageMap &);
+
+    // The cache file starts with this followed by itsXY then itsA.
+    //
+    struct CacheHeader { char magic[8]; int rows, cols, xyType, aType; };
+
+    static std::string &cacheDirectory()
+    {
+        static std::string result;
+        return result;
+    }
+
+    // Return the cache file name for this map or "" if there is no cache.
+    //
+    std::string cacheFile() const
+    {
+        const std::string &directory = cacheDirectory();
+        if (directory.empty()) return directory;
+        std::ostringstream oss;
+        oss << directory << "/";
+        for (const char *p = itsName.c_str(); *p; ++p) {
+            oss << (std::isalnum((unsigned char)*p) ? *p : '-');
+        }
+        oss << "-" << itsSize.width << "x" << itsSize.height << ".remap";
+        return oss.str();
+    }
 
-    virtual void computeXandYmaps(int i, int j) = 0;
+    size_t xyBytes() const { return itsSize.area() * CV_ELEM_SIZE(CV_16SC2); }
+    size_t aBytes()  const { return itsSize.area() * CV_ELEM_SIZE(CV_16UC1); }
+
+    // Point itsXY and itsA into a mapping of the cache file for this map.
+    // Return true if that worked or false otherwise.
+    //
+    bool load()
+    {
+        const std::string file = cacheFile();
+        if (file.empty()) return false;
+        const int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        const size_t size = sizeof(CacheHeader) + xyBytes() + aBytes();
+        struct stat st;
+        void *p = MAP_FAILED;
+        if (0 == fstat(fd, &st) && size == size_t(st.st_size)) {
+            p = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd);
+        if (p == MAP_FAILED) return false;
+        const CacheHeader &h = *(const CacheHeader *)p;
+        const bool ok
+            =  0 == std::memcmp(h.magic, "ImageMap", sizeof h.magic)
+            && h.rows == itsSize.height && h.cols == itsSize.width
+            && h.xyType == CV_16SC2 && h.aType == CV_16UC1;
+        if (!ok) {
+            munmap(p, size);
+            return false;
+        }
+        uchar *const data = (uchar *)p + sizeof h;
+        itsXY = cv::Mat(itsSize, CV_16SC2, data);
+        itsA = cv::Mat(itsSize, CV_16UC1, data + xyBytes());
+        itsMapping = p;
+        itsMappingSize = size;
+        return true;
+    }
+
+    // Write itsXY and itsA to the cache file for this map if there is one.
+    // Write a temporary file first so no reader ever sees half a map.
+    //
+    void save() const
+    {
+        const std::string file = cacheFile();
+        if (file.empty()) return;
+        assert(itsXY.isContinuous() && itsA.isContinuous());
+        CacheHeader h;
+        std::memcpy(h.magic, "ImageMap", sizeof h.magic);
+        h.rows = itsSize.height;
+        h.cols = itsSize.width;
+        h.xyType = itsXY.type();
+        h.aType = itsA.type();
+        const std::string temp = file + ".tmp";
+        std::ofstream os(temp.c_str(), std::ios::binary);
+        os.write((const char *)&h, sizeof h);
+        os.write((const char *)itsXY.data, xyBytes());
+        os.write((const char *)itsA.data, aBytes());
+        os.close();
+        if (os) {
+            std::rename(temp.c_str(), file.c_str());
+        } else {
+            std::remove(temp.c_str());
+        }
+    }
 
 protected:
 
-    cv::Mat_<float> itsX;
-    cv::Mat_<float> itsY;
+    mutable cv::Mat_<float> itsX;
+    mutable cv::Mat_<float> itsY;
+    cv::Mat itsXY;
+    cv::Mat itsA;
 
     static void init(ImageMap &m)
     {
-        assert(m.itsX.size() == m.itsY.size());
+        if (m.load()) return;
+        m.itsX.create(m.itsSize);
+        m.itsY.create(m.itsSize);
         assert(m.itsX.isContinuous());
         assert(m.itsY.isContinuous());
         const int rows = m.itsX.rows;
-        const int cols = m.itsX.cols;
         for (int i = 0; i < rows; ++i) {
-            for (int j = 0; j < cols; ++j) {
-                m.computeXandYmaps(i, j);
-            }
+            m.computeXandYmaps(i, m.itsX[i], m.itsY[i]);
         }
+        cv::convertMaps(m.itsX, m.itsY, m.itsXY, m.itsA, CV_16SC2);
+        m.save();
+    }
+
+    // Recover the float maps of m from its fixed-point maps if m came
+    // from the cache.
+    //
+    static void unfix(const ImageMap &m)
+    {
+        if (m.itsX.empty()) {
+            cv::convertMaps(m.itsXY, m.itsA, m.itsX, m.itsY, CV_32FC1);
+        }
+    }
+
+    // Resample the maps of inner at row i of the maps of outer into x and
+    // y such that remapping with them is remapping with inner and then
+    // with outer.  Send points of outer outside inner outside the image.
+    //
+    static void compose(const ImageMap &outer, const ImageMap &inner,
+                        int i, float *x, float *y)
+    {
+        static const int interpolation = cv::INTER_LINEAR;
+        static const int borderKind = cv::BORDER_CONSTANT;
+        static const cv::Scalar outside(-1.0e6);
+        unfix(outer);
+        unfix(inner);
+        assert(outer.itsX.size() == inner.itsX.size());
+        const int cols = outer.itsX.cols;
+        const cv::Mat mapX = outer.itsX.row(i);
+        const cv::Mat mapY = outer.itsY.row(i);
+        cv::Mat rowX(1, cols, CV_32FC1, x);
+        cv::Mat rowY(1, cols, CV_32FC1, y);
+        cv::remap(inner.itsX, rowX, mapX, mapY,
+                  interpolation, borderKind, outside);
+        cv::remap(inner.itsY, rowY, mapX, mapY,
+                  interpolation, borderKind, outside);
     }
 
 public:
 
-    virtual ~ImageMap() {}
+    virtual ~ImageMap()
+    {
+        if (itsMapping) munmap(itsMapping, itsMappingSize);
+    }
 
     cv::Mat operator()(const cv::Mat &image) const
     {
@@ -83,17 +241,25 @@ public:
         static const int borderKind = cv::BORDER_CONSTANT;
         static const cv::Scalar borderValue(0, 0, 0);
         cv::Mat result;
-        cv::remap(image, result, itsX, itsY,
+        cv::remap(image, result, itsXY, itsA,
                   interpolation, borderKind, borderValue);
         return result;
     }
 
-    const char *name() const { return itsName; }
+    const char *name() const { return itsName.c_str(); }
+
+    // Cache maps in files in directory from now on.
+    //
+    static void useCache(const char *directory)
+    {
+        cacheDirectory() = directory;
+    }
 
-    ImageMap(const char *n, const cv::Size &s):
+    ImageMap(const std::string &n, const cv::Size &s):
         itsName(n),
-        itsX(s, CV_32FC1),
-        itsY(s, CV_32FC1)
+        itsSize(s),
+        itsMapping(0),
+        itsMappingSize(0)
     {}
 };
 
@@ -101,10 +267,10 @@ public:
 // The identity map leaves the image unchanged.
 //
 class IdentityMap: public ImageMap {
-    virtual void computeXandYmaps(int i, int j)
+    virtual void computeXandYmaps(int i, float *x, float *y)
     {
-        itsX[i][j] = j;
-        itsY[i][j] = i;
+        for (int j = 0; j < itsX.cols; ++j) x[j] = j;
+        for (int j = 0; j < itsY.cols; ++j) y[j] = i;
     }
 public:
     IdentityMap(const cv::Size &size):
@@ -117,10 +283,10 @@ public:
 // Reflect image around its horizontal axis.
 //
 class ReflectHorizontalMap: public ImageMap {
-    virtual void computeXandYmaps(int i, int j)
+    virtual void computeXandYmaps(int i, float *x, float *y)
     {
-        itsX[i][j] = j;
-        itsY[i][j] = itsY.rows - i;
+        for (int j = 0; j < itsX.cols; ++j) x[j] = j;
+        for (int j = 0; j < itsY.cols; ++j) y[j] = itsY.rows - i;
     }
 public:
     ReflectHorizontalMap(const cv::Size &size):
@@ -133,10 +299,10 @@ public:
 // Reflect image around its vertical axis.
 //
 class ReflectVerticalMap: public ImageMap {
-    virtual void computeXandYmaps(int i, int j)
+    virtual void computeXandYmaps(int i, float *x, float *y)
     {
-        itsX[i][j] = itsX.cols - j;
-        itsY[i][j] = i;
+        for (int j = 0; j < itsX.cols; ++j) x[j] = itsX.cols - j;
+        for (int j = 0; j < itsY.cols; ++j) y[j] = i;
     }
 public:
     ReflectVerticalMap(const cv::Size &size):
@@ -150,10 +316,10 @@ public:
 // effectively rotating it 180 degrees about its center point.
 //
 class ReflectHorizontalVerticalMap: public ImageMap {
-    virtual void computeXandYmaps(int i, int j)
+    virtual void computeXandYmaps(int i, float *x, float *y)
     {
-        itsX[i][j] = itsX.cols - j;
-        itsY[i][j] = itsY.rows - i;
+        for (int j = 0; j < itsX.cols; ++j) x[j] = itsX.cols - j;
+        for (int j = 0; j < itsY.cols; ++j) y[j] = itsY.rows - i;
     }
 public:
     ReflectHorizontalVerticalMap(const cv::Size &size):
@@ -165,24 +331,23 @@ public:
 
 // Center image at half scale.
 //
+// Rows and columns outside the center half map to (0, 0).
+//
 class HalfScaleMap: public ImageMap {
-    virtual void computeXandYmaps(int i, int j)
+    virtual void computeXandYmaps(int i, float *x, float *y)
     {
-        const int minCols = itsX.cols / 4;
+        const int cols = itsX.cols;
+        const int minCols = cols / 4;
         const int maxCols = 3 * minCols;
         const int minRows = itsY.rows / 4;
         const int maxRows = 3 * minRows;
-        float x = 0.0;
-        float y = 0.0;
-        const bool ok
-            =  i < maxRows && i > minRows
-            && j < maxCols && j > minCols;
-        if (ok) {
-            x = 0.5 + 2 * (j - minCols);
-            y = 0.5 + 2 * (i - minRows);
+        const bool ok = i < maxRows && i > minRows;
+        const float yi = ok ? 0.5 + 2 * (i - minRows) : 0.0;
+        for (int j = 0; j < cols; ++j) {
+            const bool in = ok && j < maxCols && j > minCols;
+            x[j] = in ? 0.5 + 2 * (j - minCols) : 0.0;
+            y[j] = in ? yi : 0.0;
         }
-        itsX[i][j] = x;
-        itsY[i][j] = y;
     }
 public:
     HalfScaleMap(const cv::Size &size):
@@ -192,6 +357,30 @@ public:
     }
 };
 
+// Fuse outer and inner into one map such that
+//
+//    ComposedMap(outer, inner)(src) == outer(inner(src))
+//
+// give or take some interpolation, so a chain of geometric corrections
+// costs only one remap() pass.
+//
+class ComposedMap: public ImageMap {
+    const ImageMap &itsOuter;
+    const ImageMap &itsInner;
+    virtual void computeXandYmaps(int i, float *x, float *y)
+    {
+        ImageMap::compose(itsOuter, itsInner, i, x, y);
+    }
+public:
+    ComposedMap(const ImageMap &outer, const ImageMap &inner,
+                const cv::Size &size):
+        ImageMap(std::string(outer.name()) + "(" + inner.name() + ")", size),
+        itsOuter(outer), itsInner(inner)
+    {
+        ImageMap::init(*this);
+    }
+};
+
 
 // Show a remap of src in window by cycling through the mapCount image maps
 // in maps once per second until the user keys 'q'.  Return false.
@@ -217,7 +406,24 @@ static bool showRemaps(const char *window, const cv::Mat &src,
     return false;
 }
 
+// Return the average milliseconds per call to map(src) over runCount calls.
+// When twice, time map(map(src)) instead.
+//
+static double timeRemap(const ImageMap &map, const cv::Mat &src, bool twice)
+{
+    static const int runCount = 100;
+    const int64 tickZero = cv::getTickCount();
+    for (int i = 0; i < runCount; ++i) {
+        const cv::Mat dst = map(src);
+        if (twice) map(dst);
+    }
+    const int64 ticks = cv::getTickCount() - tickZero;
+    return 1000.0 * ticks / cv::getTickFrequency() / runCount;
+}
+
 // Show various map compositions of src in window until the user keys 'q'.
+// Report how long chaining each pair of maps takes compared to remapping
+// with the two composed into one map.
 //
 static bool showMapRemaps(const char *window, const cv::Mat &src,
                           int mapCount, const ImageMap *maps[])
@@ -230,11 +436,17 @@ static bool showMapRemaps(const char *window, const cv::Mat &src,
         cv::imshow(outer.name(), outerDst);
         for (int j = 0; j < mapCount; ++j) {
             const ImageMap &inner = *maps[j];
+            const ComposedMap composed(outer, inner, src.size());
             const char *const name = i == j ? window : inner.name();
-            const cv::Mat dst = outer(inner(src));
+            const cv::Mat dst = composed(src);
             makeWindow(name, dst);
             cv::imshow(name, dst);
         }
+        const ComposedMap twice(outer, outer, src.size());
+        std::cout << outer.name() << " twice: "
+                  << timeRemap(outer, src, true) << " ms chained, "
+                  << timeRemap(twice, src, false) << " ms composed"
+                  << std::endl;
         if (waitSeconds(10)) return true;
     }
     return false;
@@ -242,17 +454,24 @@ static bool showMapRemaps(const char *window, const cv::Mat &src,
 
 int main(int ac, const char *av[])
 {
-    if (ac == 2) {
+    if (ac == 2 || ac == 3) {
         const cv::Mat src = cv::imread(av[1]);
         if (src.data) {
             std::cout << av[0] << ": Press 'q' to quit or" << std::endl
                       << av[0] << ": another key to advance." << std::endl;
+            if (ac == 3) ImageMap::useCache(av[2]);
             const cv::Size size = src.size();
+            const int64 tickZero = cv::getTickCount();
             const IdentityMap                  id(size);
             const ReflectHorizontalMap         rh(size);
             const ReflectVerticalMap           rv(size);
             const ReflectHorizontalVerticalMap rb(size);
             const HalfScaleMap                 qs(size);
+            const int64 ticks = cv::getTickCount() - tickZero;
+            std::cout << av[0] << ": made maps in "
+                      << 1000.0 * ticks / cv::getTickFrequency() << " ms"
+                      << (ac == 3 ? " with cache in " : " without cache")
+                      << (ac == 3 ? av[2] : "") << std::endl;
             const ImageMap *map[] = { &id, &rh, &rv, &rb, &qs };
             const int mapCount = sizeof map / sizeof map[0];
             const bool quit
@@ -264,11 +483,13 @@ int main(int ac, const char *av[])
     }
     std::cerr << av[0] << ": Demonstrate image remapping."
               << std::endl << std::endl
-              << "Usage: " << av[0] << " <image-file>" << std::endl
-              << std::endl
+              << "Usage: " << av[0] << " <image-file> [<cache-dir>]"
+              << std::endl << std::endl
               << "Where: <image-file> is the name of an image file."
+              << std::endl
+              << "       <cache-dir> is a directory to cache maps in."
               << std::endl << std::endl
-              << "Example: " << av[0] << " ../resources/lena.jpg"
+              << "Example: " << av[0] << " ../resources/lena.jpg ."
               << std::endl << std::endl;
     return 1;
 }
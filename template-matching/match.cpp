@@ -1,6 +1,13 @@
+#include <opencv2/core/utility.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <string>
+#include <vector>
 
 
 // Wait seconds or until some key is pressed.
@@ -96,6 +103,979 @@ static const struct MatchMethod {
 };
 static const int matchMethodCount = sizeof matchMethod / sizeof matchMethod[0];
 
+// Match templates against one src with cv::TM_CCOEFF_NORMED by
+// multiplying spectra, sharing the transform of src among all templates
+// of the same padded DFT size.
+//
+// src is cut into tiles of the DFT size overlapping by the largest
+// template size less one, so the spectra of the tiles of src serve every
+// template padded out to that size.  The correlations of all channels
+// are summed in the frequency domain, so each tile costs one inverse DFT
+// per template.  The local sums of src under the template, which
+// normalize the correlation, come from integral images.
+//
+// Once share() has computed the tile spectra, operator() is const and
+// may run for several templates at once.
+//
+class SpectralMatcher {
+
+    typedef std::pair<int, int> SizeKey;
+    typedef std::vector<cv::Mat> Planes;
+
+    static SizeKey key(const cv::Size &s)
+    {
+        return SizeKey(s.width, s.height);
+    }
+
+public:
+
+    // The spectra of the zero-mean planes of a template padded out to the
+    // tile DFT size for templates of its size and a source of some size.
+    //
+    struct Template {
+        cv::Size size;
+        cv::Size dft;
+        Planes planes;
+        double norm;
+    };
+
+    // Return the tile DFT size for a template of size tmp in a source of
+    // size src: large enough that each tile yields several template sizes
+    // of results, but no larger than src needs.
+    //
+    static cv::Size dftSize(const cv::Size &src, const cv::Size &tmp)
+    {
+        static const int minimum = 128;
+        const int cols = std::min(src.width, std::max(4 * tmp.width, minimum));
+        const int rows = std::min(src.height,
+                                  std::max(4 * tmp.height, minimum));
+        return cv::Size(cv::getOptimalDFTSize(std::max(cols, tmp.width)),
+                        cv::getOptimalDFTSize(std::max(rows, tmp.height)));
+    }
+
+    // Return the Template for matching tmp against sources of size src.
+    //
+    static Template prepare(const cv::Mat &tmp, const cv::Size &src)
+    {
+        Template result;
+        result.size = tmp.size();
+        result.dft = dftSize(src, tmp.size());
+        cv::Mat t;
+        tmp.convertTo(t, CV_32F);
+        cv::split(t, result.planes);
+        double norm = 0.0;
+        for (size_t c = 0; c < result.planes.size(); ++c) {
+            cv::Mat &plane = result.planes[c];
+            plane -= cv::mean(plane);
+            norm += plane.dot(plane);
+            cv::copyMakeBorder(plane, plane,
+                               0, result.dft.height - plane.rows,
+                               0, result.dft.width - plane.cols,
+                               cv::BORDER_CONSTANT, cv::Scalar::all(0));
+            cv::dft(plane, plane, 0, tmp.rows);
+        }
+        result.norm = std::sqrt(norm);
+        return result;
+    }
+
+private:
+
+    // The spectra of the tiles of src for templates of one DFT size.
+    //
+    struct Tiles {
+        cv::Size block;
+        int across;
+        int down;
+        std::vector<Planes> spectra;
+    };
+
+    const cv::Mat itsSrc;
+    cv::Mat itsSum;
+    cv::Mat itsSqSum;
+    std::map<SizeKey, Tiles> itsTiles;
+
+    // Make the spectra of tiles of src of size dft, stepping by the block
+    // of results a template of size largest yields from each tile, and
+    // covering all the results for a template of size smallest.
+    //
+    void makeTiles(const cv::Size &dft,
+                   const cv::Size &largest, const cv::Size &smallest)
+    {
+        Tiles &result = itsTiles[key(dft)];
+        const cv::Size matches = itsSrc.size() - smallest + cv::Size(1, 1);
+        const cv::Size block = dft - largest + cv::Size(1, 1);
+        result.block = block;
+        result.across = (matches.width + block.width - 1) / block.width;
+        result.down = (matches.height + block.height - 1) / block.height;
+        result.spectra.clear();
+        for (int ty = 0; ty < result.down; ++ty) {
+            for (int tx = 0; tx < result.across; ++tx) {
+                const int x = tx * block.width;
+                const int y = ty * block.height;
+                const int cols = std::min(dft.width, itsSrc.cols - x);
+                const int rows = std::min(dft.height, itsSrc.rows - y);
+                const cv::Rect tile(x, y, cols, rows);
+                cv::Mat f;
+                itsSrc(tile).convertTo(f, CV_32F);
+                Planes planes;
+                cv::split(f, planes);
+                for (size_t c = 0; c < planes.size(); ++c) {
+                    cv::copyMakeBorder(planes[c], planes[c],
+                                       0, dft.height - tile.height,
+                                       0, dft.width - tile.width,
+                                       cv::BORDER_CONSTANT,
+                                       cv::Scalar::all(0));
+                    cv::dft(planes[c], planes[c], 0, tile.height);
+                }
+                result.spectra.push_back(planes);
+            }
+        }
+    }
+
+    // Divide the correlations in the CV_32F matches of a template of size
+    // t and norm by the norms of src under it at each location.
+    //
+    void normalize(cv::Mat &matches, const cv::Size &t, double norm) const
+    {
+        static const double epsilon = 1.0e-6;
+        const int cn = itsSrc.channels();
+        const double n = t.area();
+        for (int y = 0; y < matches.rows; ++y) {
+            const double *const s0 = itsSum.ptr<double>(y);
+            const double *const s1 = itsSum.ptr<double>(y + t.height);
+            const double *const q0 = itsSqSum.ptr<double>(y);
+            const double *const q1 = itsSqSum.ptr<double>(y + t.height);
+            float *const m = matches.ptr<float>(y);
+            for (int x = 0; x < matches.cols; ++x) {
+                const int l = x * cn, r = (x + t.width) * cn;
+                double variance = 0.0;
+                for (int c = 0; c < cn; ++c) {
+                    const double s
+                        = s1[r + c] - s1[l + c] - s0[r + c] + s0[l + c];
+                    const double q
+                        = q1[r + c] - q1[l + c] - q0[r + c] + q0[l + c];
+                    variance += q - s * s / n;
+                }
+                const double d = norm * std::sqrt(std::max(variance, 0.0));
+                m[x] = d > epsilon ? m[x] / d : 0.0f;
+            }
+        }
+    }
+
+public:
+
+    // Compute the tile spectra of src once for each DFT size among ts,
+    // stepping by what the largest template of that size allows.
+    //
+    void share(const std::vector<Template> &ts)
+    {
+        std::map<SizeKey, cv::Size> largest, smallest;
+        for (size_t i = 0; i < ts.size(); ++i) {
+            const SizeKey k = key(ts[i].dft);
+            const cv::Size &s = ts[i].size;
+            if (largest.count(k)) {
+                cv::Size &l = largest[k], &m = smallest[k];
+                l = cv::Size(std::max(l.width, s.width),
+                             std::max(l.height, s.height));
+                m = cv::Size(std::min(m.width, s.width),
+                             std::min(m.height, s.height));
+            } else {
+                largest[k] = smallest[k] = s;
+            }
+        }
+        std::map<SizeKey, cv::Size>::const_iterator it = largest.begin();
+        for (; it != largest.end(); ++it) {
+            const cv::Size dft(it->first.first, it->first.second);
+            makeTiles(dft, it->second, smallest[it->first]);
+        }
+    }
+
+    // Return the cv::TM_CCOEFF_NORMED matches of t against src, as
+    // cv::matchTemplate() would.  share() must have seen t.
+    //
+    cv::Mat operator()(const Template &t) const
+    {
+        static const bool conjugate = true;
+        static const int inverse
+            = cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT;
+        const std::map<SizeKey, Tiles>::const_iterator it
+            = itsTiles.find(key(t.dft));
+        CV_Assert(it != itsTiles.end());
+        const Tiles &ts = it->second;
+        const cv::Size size = itsSrc.size() - t.size + cv::Size(1, 1);
+        CV_Assert(ts.block.width + t.size.width <= t.dft.width + 1);
+        CV_Assert(ts.block.height + t.size.height <= t.dft.height + 1);
+        CV_Assert(ts.across * ts.block.width >= size.width);
+        CV_Assert(ts.down * ts.block.height >= size.height);
+        cv::Mat result(size, CV_32FC1);
+        cv::Mat product, sum;
+        for (int ty = 0; ty < ts.down; ++ty) {
+            const int y = ty * ts.block.height;
+            if (y >= size.height) break;
+            for (int tx = 0; tx < ts.across; ++tx) {
+                const int x = tx * ts.block.width;
+                if (x >= size.width) break;
+                const Planes &tile = ts.spectra[ty * ts.across + tx];
+                for (size_t c = 0; c < tile.size(); ++c) {
+                    cv::mulSpectrums(tile[c], t.planes[c], product, 0,
+                                     conjugate);
+                    if (c) sum += product; else product.copyTo(sum);
+                }
+                const int cols = std::min(ts.block.width, size.width - x);
+                const int rows = std::min(ts.block.height, size.height - y);
+                const cv::Rect block(x, y, cols, rows);
+                cv::dft(sum, sum, inverse, block.height);
+                sum(cv::Rect(cv::Point(0, 0), block.size()))
+                    .copyTo(result(block));
+            }
+        }
+        normalize(result, t.size, t.norm);
+        return result;
+    }
+
+    SpectralMatcher(const cv::Mat &src): itsSrc(src)
+    {
+        cv::integral(src, itsSum, itsSqSum, CV_64F, CV_64F);
+    }
+};
+
+// Return the raw matches of tmp against src according to method.
+//
+// Use SpectralMatcher for cv::TM_CCOEFF_NORMED when tmp is at least
+// fftArea pixels, and cv::matchTemplate() otherwise.
+//
+static cv::Mat rawMatches(const cv::Mat &src, const cv::Mat &tmp, int method)
+{
+    static const size_t fftArea = 32 * 32;
+    if (method == cv::TM_CCOEFF_NORMED && tmp.total() >= fftArea) {
+        const std::vector<SpectralMatcher::Template> ts(
+            1, SpectralMatcher::prepare(tmp, src.size()));
+        SpectralMatcher matcher(src);
+        matcher.share(ts);
+        return matcher(ts[0]);
+    }
+    cv::Mat result;
+    cv::matchTemplate(src, tmp, result, method);
+    return result;
+}
+
+// A location and score of a match.
+//
+struct Match {
+    cv::Point location;
+    double score;
+    Match(const cv::Point &l, double s): location(l), score(s) {}
+};
+
+// Find tmp in src coarse to fine with method.
+//
+// Shrink src and tmp with cv::pyrDown() a few levels(), then search all
+// of the coarsest level and keep the best few candidates at least a
+// template apart.  At each finer level, search only a window margin
+// pixels around each doubled candidate location, and keep the best
+// candidates again.  So all but the coarsest search cover a few small
+// windows, and a large template is matched by SpectralMatcher at the
+// coarsest level.
+//
+class PyramidMatcher {
+
+    const MatchMethod &itsMethod;
+
+    bool better(double a, double b) const
+    {
+        return itsMethod.useMin ? a < b : a > b;
+    }
+
+    // Return up to count best matches in matches at least apart from
+    // each other, clobbering matches.
+    //
+    std::vector<Match> best(cv::Mat matches, int count,
+                            const cv::Size &apart) const
+    {
+        std::vector<Match> result;
+        double minVal, maxVal;
+        cv::Point minLoc, maxLoc;
+        cv::minMaxLoc(matches, &minVal, &maxVal, &minLoc, &maxLoc);
+        const double worst = itsMethod.useMin ? maxVal : minVal;
+        for (int i = 0; i < count; ++i) {
+            cv::minMaxLoc(matches, &minVal, &maxVal, &minLoc, &maxLoc);
+            const cv::Point at = itsMethod.useMin ? minLoc : maxLoc;
+            const double score = itsMethod.useMin ? minVal : maxVal;
+            if (i && !better(score, worst)) break;
+            result.push_back(Match(at, score));
+            const cv::Rect near(at - cv::Point(apart) / 2, apart);
+            matches(near & cv::Rect(cv::Point(0, 0), matches.size()))
+                = cv::Scalar::all(worst);
+        }
+        return result;
+    }
+
+public:
+
+    typedef std::vector<cv::Mat> Pyramid;
+
+    // Return how many times to halve a template of size tmp: until it is
+    // about minSize on its smaller side, but at most maxLevels times.
+    //
+    static int levels(cv::Size tmp)
+    {
+        static const int minSize = 12;
+        static const int maxLevels = 4;
+        int result = 0;
+        while (result < maxLevels
+               && std::min(tmp.width, tmp.height) >= 2 * minSize) {
+            tmp = cv::Size((tmp.width + 1) / 2, (tmp.height + 1) / 2);
+            ++result;
+        }
+        return result;
+    }
+
+    // Add levels to p with cv::pyrDown() until it has count levels.
+    //
+    static void extend(Pyramid &p, int count)
+    {
+        while (int(p.size()) < count) {
+            cv::Mat m;
+            cv::pyrDown(p.back(), m);
+            p.push_back(m);
+        }
+    }
+
+    // Return the best few candidates at least a template apart for the
+    // coarsest level of tmps in the same level of srcs.
+    //
+    std::vector<Match> coarse(const Pyramid &srcs, const Pyramid &tmps) const
+    {
+        static const int candidates = 4;
+        const int level = tmps.size() - 1;
+        const int kind = itsMethod.kind;
+        const cv::Mat top = rawMatches(srcs[level], tmps[level], kind);
+        return best(top, candidates, tmps[level].size());
+    }
+
+    // Return the best of matches from the coarsest level of tmps after
+    // refining each down through the finer levels of tmps and srcs.
+    //
+    Match refine(const Pyramid &srcs, const Pyramid &tmps,
+                 std::vector<Match> matches) const
+    {
+        static const int margin = 2;
+        int level = tmps.size() - 1;
+        while (level-- > 0) {
+            const cv::Mat &s = srcs[level];
+            const cv::Mat &t = tmps[level];
+            const cv::Size size = s.size() - t.size() + cv::Size(1, 1);
+            const cv::Rect valid(cv::Point(0, 0), size);
+            std::vector<Match> finer;
+            for (size_t i = 0; i < matches.size(); ++i) {
+                const cv::Point center = 2 * matches[i].location;
+                const cv::Point corner = center - cv::Point(margin, margin);
+                const cv::Size side(2 * margin + 1, 2 * margin + 1);
+                const cv::Rect window = cv::Rect(corner, side) & valid;
+                if (window.area() == 0) continue;
+                const cv::Rect roi(window.tl(), window.size() + t.size()
+                                   - cv::Size(1, 1));
+                cv::Mat local;
+                cv::matchTemplate(s(roi), t, local, itsMethod.kind);
+                const std::vector<Match> b = best(local, 1, t.size());
+                const cv::Point location = b[0].location + window.tl();
+                finer.push_back(Match(location, b[0].score));
+            }
+            matches.swap(finer);
+        }
+        if (matches.empty()) return Match(cv::Point(-1, -1), 0.0);
+        size_t b = 0;
+        for (size_t i = 1; i < matches.size(); ++i) {
+            if (better(matches[i].score, matches[b].score)) b = i;
+        }
+        return matches[b];
+    }
+
+    // Return the best location of tmp in src and set *score to its score.
+    //
+    cv::Point operator()(const cv::Mat &src, const cv::Mat &tmp,
+                         double *score = 0) const
+    {
+        const int count = 1 + levels(tmp.size());
+        Pyramid srcs(1, src), tmps(1, tmp);
+        extend(srcs, count);
+        extend(tmps, count);
+        const Match result = refine(srcs, tmps, coarse(srcs, tmps));
+        if (score) *score = result.score;
+        return result.location;
+    }
+
+    PyramidMatcher(const MatchMethod &method): itsMethod(method) {}
+};
+
+// Find a set of templates in sources of one size with
+// cv::TM_CCOEFF_NORMED, such as logos in the frames of a video.
+//
+// The template spectra are computed once, sorted by padded DFT size, when
+// the BatchMatcher is made.  Each source is transformed once per DFT size
+// among the templates, then all templates are matched against it in
+// parallel.
+//
+class BatchMatcher {
+
+    const cv::Size itsSize;
+    std::vector<SpectralMatcher::Template> itsTemplates;
+    std::vector<int> itsOrder;
+
+    // Sort templates by DFT size so neighbors share tile spectra.
+    //
+    struct ByDftSize {
+        const std::vector<SpectralMatcher::Template> &templates;
+        bool operator()(int a, int b) const {
+            const cv::Size &da = templates[a].dft;
+            const cv::Size &db = templates[b].dft;
+            return da.width < db.width
+                || (da.width == db.width && da.height < db.height);
+        }
+        ByDftSize(const std::vector<SpectralMatcher::Template> &t):
+            templates(t) {}
+    };
+
+    // Match some of the templates in parallel.
+    //
+    struct Stripe: cv::ParallelLoopBody {
+        const SpectralMatcher &matcher;
+        const BatchMatcher &batch;
+        std::vector<Match> &result;
+        void operator()(const cv::Range &range) const {
+            for (int i = range.start; i < range.end; ++i) {
+                const int t = batch.itsOrder[i];
+                const cv::Mat matches = matcher(batch.itsTemplates[t]);
+                double maxVal;
+                cv::Point maxLoc;
+                cv::minMaxLoc(matches, 0, &maxVal, 0, &maxLoc);
+                result[t] = Match(maxLoc, maxVal);
+            }
+        }
+        Stripe(const SpectralMatcher &m, const BatchMatcher &b,
+               std::vector<Match> &r): matcher(m), batch(b), result(r) {}
+    };
+
+public:
+
+    // Return the number of templates.
+    //
+    size_t size() const { return itsTemplates.size(); }
+
+    // Return the best match of each template in src in template order.
+    //
+    std::vector<Match> operator()(const cv::Mat &src) const
+    {
+        CV_Assert(src.size() == itsSize);
+        std::vector<Match> result(size(), Match(cv::Point(-1, -1), 0.0));
+        SpectralMatcher matcher(src);
+        matcher.share(itsTemplates);
+        const Stripe stripe(matcher, *this, result);
+        cv::parallel_for_(cv::Range(0, size()), stripe);
+        return result;
+    }
+
+    // Prepare tmps for matching against sources of size src.
+    //
+    BatchMatcher(const std::vector<cv::Mat> &tmps, const cv::Size &src):
+        itsSize(src)
+    {
+        for (size_t i = 0; i < tmps.size(); ++i) {
+            CV_Assert(tmps[i].cols <= src.width && tmps[i].rows <= src.height);
+            itsTemplates.push_back(SpectralMatcher::prepare(tmps[i], src));
+            itsOrder.push_back(i);
+        }
+        std::stable_sort(itsOrder.begin(), itsOrder.end(),
+                         ByDftSize(itsTemplates));
+    }
+};
+
+// Find each of the templates in files in src with BatchMatcher, and with
+// one cv::matchTemplate() call per template.  Report a table of the best
+// location and score of each template, and the time each way took.
+//
+static void reportBatch(const cv::Mat &src,
+                        const std::vector<std::string> &files)
+{
+    const double msPerTick = 1000.0 / cv::getTickFrequency();
+    std::vector<cv::Mat> tmps;
+    for (size_t i = 0; i < files.size(); ++i) {
+        tmps.push_back(cv::imread(files[i]));
+        if (!tmps.back().data) {
+            std::cerr << "Cannot read template " << files[i] << std::endl;
+            return;
+        }
+    }
+    const int64 tickZero = cv::getTickCount();
+    const BatchMatcher batch(tmps, src.size());
+    const int64 tickOne = cv::getTickCount();
+    const std::vector<Match> matches = batch(src);
+    const int64 tickTwo = cv::getTickCount();
+    std::vector<Match> singles;
+    for (size_t i = 0; i < tmps.size(); ++i) {
+        cv::Mat result;
+        cv::matchTemplate(src, tmps[i], result, cv::TM_CCOEFF_NORMED);
+        double maxVal;
+        cv::Point maxLoc;
+        cv::minMaxLoc(result, 0, &maxVal, 0, &maxLoc);
+        singles.push_back(Match(maxLoc, maxVal));
+    }
+    const int64 tickThree = cv::getTickCount();
+    std::cout << std::fixed << std::setprecision(4);
+    std::cout << std::setw(32) << std::left << "template"
+              << std::setw(8) << std::right << "x" << std::setw(8) << "y"
+              << std::setw(10) << "score" << std::setw(10) << "single"
+              << std::endl;
+    for (size_t i = 0; i < matches.size(); ++i) {
+        std::cout << std::setw(32) << std::left << files[i]
+                  << std::setw(8) << std::right << matches[i].location.x
+                  << std::setw(8) << matches[i].location.y
+                  << std::setw(10) << matches[i].score
+                  << std::setw(10) << singles[i].score
+                  << (singles[i].location == matches[i].location
+                      ? "" : " (moved)")
+                  << std::endl;
+    }
+    std::cout << std::setprecision(2)
+              << "Prepared " << tmps.size() << " templates in "
+              << (tickOne - tickZero) * msPerTick << " ms." << std::endl
+              << "Batch matched in "
+              << (tickTwo - tickOne) * msPerTick << " ms." << std::endl
+              << "cv::matchTemplate() took "
+              << (tickThree - tickTwo) * msPerTick << " ms." << std::endl;
+}
+
+// Track a template through the frames of a video with
+// cv::TM_CCOEFF_NORMED.
+//
+// After a full search of the first frame, search only a window around
+// where the last match and the measured velocity predict the template to
+// be.  The window grows with the speed of the template up to maxMargin,
+// so the cost of each frame depends on the template and its speed but
+// not on the frame size.  Search the whole frame again, coarse to fine,
+// when the best score in the window falls below minScore.
+//
+class TemplateTracker {
+
+    const cv::Mat itsTmp;
+    const PyramidMatcher itsFull;
+    bool itsFound;
+    cv::Point itsLocation;
+    cv::Point2f itsVelocity;
+    double itsScore;
+    int itsFullSearches;
+
+    static double minScore() { return 0.8; }
+
+    // Return the window of match locations in a frame of size frame to
+    // search around the predicted location.
+    //
+    cv::Rect window(const cv::Size &frame) const
+    {
+        static const int minMargin = 8;
+        static const int maxMargin = 64;
+        static const float speedGain = 2.0f;
+        const cv::Point2f predicted = cv::Point2f(itsLocation) + itsVelocity;
+        const int mx = std::min(maxMargin, minMargin + cvRound(
+                                    speedGain * std::fabs(itsVelocity.x)));
+        const int my = std::min(maxMargin, minMargin + cvRound(
+                                    speedGain * std::fabs(itsVelocity.y)));
+        const cv::Point corner(cvRound(predicted.x) - mx,
+                               cvRound(predicted.y) - my);
+        const cv::Size size = frame - itsTmp.size() + cv::Size(1, 1);
+        const cv::Rect valid(cv::Point(0, 0), size);
+        return cv::Rect(corner, cv::Size(2 * mx + 1, 2 * my + 1)) & valid;
+    }
+
+    // Move to p with score, and smooth the velocity.
+    //
+    void moveTo(const cv::Point &p, double score)
+    {
+        static const float smooth = 0.5f;
+        const cv::Point2f step = cv::Point2f(p - itsLocation);
+        itsVelocity = smooth * itsVelocity + (1.0f - smooth) * step;
+        itsLocation = p;
+        itsScore = score;
+    }
+
+    // Return true if tmp is found in the window of frame.
+    //
+    bool searchWindow(const cv::Mat &frame)
+    {
+        const cv::Rect w = window(frame.size());
+        if (w.area() == 0) return false;
+        const cv::Rect roi(w.tl(), w.size() + itsTmp.size()
+                           - cv::Size(1, 1));
+        cv::Mat matches;
+        cv::matchTemplate(frame(roi), itsTmp, matches, cv::TM_CCOEFF_NORMED);
+        double maxVal;
+        cv::Point maxLoc;
+        cv::minMaxLoc(matches, 0, &maxVal, 0, &maxLoc);
+        if (maxVal < minScore()) return false;
+        moveTo(maxLoc + w.tl(), maxVal);
+        return true;
+    }
+
+    // Return true if tmp is found anywhere in frame.
+    //
+    bool searchFull(const cv::Mat &frame)
+    {
+        ++itsFullSearches;
+        double score = 0.0;
+        const cv::Point p = itsFull(frame, itsTmp, &score);
+        itsScore = score;
+        if (score < minScore()) return false;
+        itsLocation = p;
+        itsVelocity = cv::Point2f(0.0f, 0.0f);
+        return true;
+    }
+
+public:
+
+    // Find the template in frame and return true if found.
+    //
+    bool operator()(const cv::Mat &frame)
+    {
+        itsFound = (itsFound && searchWindow(frame)) || searchFull(frame);
+        return itsFound;
+    }
+
+    // Return where the template was last found.
+    //
+    cv::Rect location() const { return cv::Rect(itsLocation, itsTmp.size()); }
+
+    // Return the score of the last search.
+    //
+    double score() const { return itsScore; }
+
+    // Return the number of full frame searches so far.
+    //
+    int fullSearches() const { return itsFullSearches; }
+
+    TemplateTracker(const cv::Mat &tmp):
+        itsTmp(tmp), itsFull(matchMethod[matchMethodCount - 1]),
+        itsFound(false), itsLocation(0, 0), itsVelocity(0.0f, 0.0f),
+        itsScore(0.0), itsFullSearches(0)
+    {
+        CV_Assert(matchMethod[matchMethodCount - 1].kind
+                  == cv::TM_CCOEFF_NORMED);
+    }
+};
+
+// Track tmp through the video in file with TemplateTracker and show
+// where it is in each frame.  Report the time tracking took per frame
+// and how many frames needed a full search.
+//
+static bool trackTemplate(const char *file, const cv::Mat &tmp)
+{
+    cv::VideoCapture video(file);
+    if (!video.isOpened()) return false;
+    TemplateTracker track(tmp);
+    const double msPerTick = 1000.0 / cv::getTickFrequency();
+    cv::Mat frame;
+    cv::Size size;
+    int64 ticks = 0;
+    int count = 0, found = 0;
+    std::cout << std::fixed << std::setprecision(3);
+    while (video.read(frame)) {
+        if (frame.cols < tmp.cols || frame.rows < tmp.rows) return false;
+        size = frame.size();
+        const int64 tickZero = cv::getTickCount();
+        const bool hit = track(frame);
+        ticks += cv::getTickCount() - tickZero;
+        ++count;
+        if (hit) {
+            ++found;
+            const cv::Rect r = track.location();
+            drawMatch(frame, tmp, r.tl());
+        }
+        if (count == 1) {
+            makeWindow("Template Tracking", frame, 1);
+        } else {
+            cv::imshow("Template Tracking", frame);
+        }
+        if ('q' == cv::waitKey(1)) break;
+    }
+    std::cout << count << " frames of " << size.width << "x" << size.height
+              << ", found in " << found << " with " << track.fullSearches()
+              << " full searches, " << (count ? ticks * msPerTick / count
+                                          : 0.0)
+              << " ms per frame" << std::endl;
+    return true;
+}
+
+// The geometric ladder of scales 1.2 apart from scale-plot/scale.cpp.
+//
+static const float scaleLadder[] = {
+    0.16151, 0.19381, 0.23257, 0.27908, 0.33490,
+    0.40188, 0.48225, 0.57870, 0.69444, 0.83333,
+    1.00000,
+    1.20000, 1.44000, 1.72800, 2.07360, 2.48832,
+    2.98598, 3.58318, 4.29982, 5.15978, 6.19174
+};
+static const int scaleLadderCount
+= sizeof scaleLadder / sizeof scaleLadder[0];
+
+// Find a template at any scale on scaleLadder with cv::TM_CCOEFF_NORMED.
+//
+// Resize only the template, never the source, to each scale at which it
+// fits, straight to the size of each level PyramidMatcher would search.
+// Search the coarsest level of every scale in parallel on one pyramid of
+// the source, then refine in parallel only the few scales whose coarse
+// scores come within slack of the best.
+//
+class MultiScaleMatcher {
+
+    typedef PyramidMatcher::Pyramid Pyramid;
+
+    // A scale of the template, its pyramid, and its matches.
+    //
+    struct Scale {
+        int index;
+        Pyramid tmps;
+        std::vector<Match> candidates;
+        Match best;
+        Scale(): index(-1), best(cv::Point(-1, -1), 0.0) {}
+    };
+
+    // Order Scales by their best coarse score, best first.
+    //
+    struct ByCoarseScore {
+        bool operator()(const Scale &a, const Scale &b) const {
+            return a.candidates[0].score > b.candidates[0].score;
+        }
+    };
+
+    // Search the coarsest level of some scales in parallel.
+    //
+    struct Coarse: cv::ParallelLoopBody {
+        const PyramidMatcher &pyramid;
+        const Pyramid &srcs;
+        std::vector<Scale> &scales;
+        void operator()(const cv::Range &range) const {
+            for (int i = range.start; i < range.end; ++i) {
+                scales[i].candidates = pyramid.coarse(srcs, scales[i].tmps);
+            }
+        }
+        Coarse(const PyramidMatcher &p, const Pyramid &s,
+               std::vector<Scale> &v): pyramid(p), srcs(s), scales(v) {}
+    };
+
+    // Refine the candidates of some scales in parallel.
+    //
+    struct Refine: cv::ParallelLoopBody {
+        const PyramidMatcher &pyramid;
+        const Pyramid &srcs;
+        std::vector<Scale> &scales;
+        void operator()(const cv::Range &range) const {
+            for (int i = range.start; i < range.end; ++i) {
+                Scale &s = scales[i];
+                s.best = pyramid.refine(srcs, s.tmps, s.candidates);
+            }
+        }
+        Refine(const PyramidMatcher &p, const Pyramid &s,
+               std::vector<Scale> &v): pyramid(p), srcs(s), scales(v) {}
+    };
+
+    const cv::Mat itsTmp;
+    const PyramidMatcher itsPyramid;
+
+    // Return the template resized for each level of the pyramid searched
+    // at scaleLadder[i] in sources of size src, or an empty Pyramid if
+    // that scale of the template is too small or does not fit.
+    //
+    Pyramid scaled(int i, const cv::Size &src) const
+    {
+        static const int minSide = 8;
+        const float scale = scaleLadder[i];
+        cv::Size size(cvRound(itsTmp.cols * scale),
+                      cvRound(itsTmp.rows * scale));
+        Pyramid result;
+        if (std::min(size.width, size.height) < minSide) return result;
+        if (size.width > src.width || size.height > src.height) {
+            return result;
+        }
+        const int levels = PyramidMatcher::levels(size);
+        for (int level = 0; level <= levels; ++level) {
+            const int kind = size.width < itsTmp.cols
+                ? cv::INTER_AREA : cv::INTER_LINEAR;
+            cv::Mat t;
+            cv::resize(itsTmp, t, size, 0.0, 0.0, kind);
+            result.push_back(t);
+            size = cv::Size((size.width + 1) / 2, (size.height + 1) / 2);
+        }
+        return result;
+    }
+
+public:
+
+    // Return the best match of the template in src and set *scale to the
+    // scale of the template there.  Set *refined to the number of scales
+    // refined after pruning.
+    //
+    Match operator()(const cv::Mat &src, float *scale, int *refined = 0)
+        const
+    {
+        static const double slack = 0.1;
+        static const int survivors = 3;
+        std::vector<Scale> scales;
+        int count = 1;
+        for (int i = 0; i < scaleLadderCount; ++i) {
+            Scale s;
+            s.index = i;
+            s.tmps = scaled(i, src.size());
+            if (s.tmps.empty()) continue;
+            count = std::max(count, int(s.tmps.size()));
+            scales.push_back(s);
+        }
+        if (refined) *refined = 0;
+        if (scales.empty()) return Match(cv::Point(-1, -1), 0.0);
+        Pyramid srcs(1, src);
+        PyramidMatcher::extend(srcs, count);
+        const cv::Range all(0, scales.size());
+        cv::parallel_for_(all, Coarse(itsPyramid, srcs, scales));
+        std::sort(scales.begin(), scales.end(), ByCoarseScore());
+        const double worst = scales[0].candidates[0].score - slack;
+        int keep = 1;
+        while (keep < std::min(survivors, int(scales.size()))
+               && scales[keep].candidates[0].score >= worst) ++keep;
+        scales.resize(keep);
+        cv::parallel_for_(cv::Range(0, keep),
+                          Refine(itsPyramid, srcs, scales));
+        size_t b = 0;
+        for (size_t i = 1; i < scales.size(); ++i) {
+            if (scales[i].best.score > scales[b].best.score) b = i;
+        }
+        if (scale) *scale = scaleLadder[scales[b].index];
+        if (refined) *refined = keep;
+        return scales[b].best;
+    }
+
+    MultiScaleMatcher(const cv::Mat &tmp):
+        itsTmp(tmp), itsPyramid(matchMethod[matchMethodCount - 1])
+    {
+        CV_Assert(matchMethod[matchMethodCount - 1].kind
+                  == cv::TM_CCOEFF_NORMED);
+    }
+};
+
+// Return the best match of tmp in src with cv::TM_CCOEFF_NORMED after
+// trying every scale on scaleLadder over all of src, and set *scale to
+// the scale of tmp there.
+//
+static Match exhaustiveScales(const cv::Mat &src, const cv::Mat &tmp,
+                              float *scale)
+{
+    Match result(cv::Point(-1, -1), 0.0);
+    for (int i = 0; i < scaleLadderCount; ++i) {
+        const cv::Size size(cvRound(tmp.cols * scaleLadder[i]),
+                            cvRound(tmp.rows * scaleLadder[i]));
+        if (size.width > src.cols || size.height > src.rows) continue;
+        if (size.area() == 0) continue;
+        const int kind = scaleLadder[i] < 1.0f
+            ? cv::INTER_AREA : cv::INTER_LINEAR;
+        cv::Mat t, matches;
+        cv::resize(tmp, t, size, 0.0, 0.0, kind);
+        cv::matchTemplate(src, t, matches, cv::TM_CCOEFF_NORMED);
+        double maxVal;
+        cv::Point maxLoc;
+        cv::minMaxLoc(matches, 0, &maxVal, 0, &maxLoc);
+        if (maxVal > result.score) {
+            result = Match(maxLoc, maxVal);
+            *scale = scaleLadder[i];
+        }
+    }
+    return result;
+}
+
+// Resize src by a few scales on scaleLadder, so that tmp appears in it
+// at that scale, and find tmp in it with MultiScaleMatcher and with
+// exhaustiveScales().  Report the location, scale, score, and time of
+// each.
+//
+static void reportScales(const cv::Mat &src, const cv::Mat &tmp)
+{
+    static const int checks[] = { 5, 7, 10, 12, 13, 15 };
+    static const int checkCount = sizeof checks / sizeof checks[0];
+    const double msPerTick = 1000.0 / cv::getTickFrequency();
+    const MultiScaleMatcher matcher(tmp);
+    std::cout << std::fixed;
+    for (int i = 0; i < checkCount; ++i) {
+        const float f = scaleLadder[checks[i]];
+        const int kind = f < 1.0f ? cv::INTER_AREA : cv::INTER_LINEAR;
+        cv::Mat scaled;
+        cv::resize(src, scaled, cv::Size(), f, f, kind);
+        float multiScale = 0.0f, exhaustive = 0.0f;
+        int refined = 0;
+        const int64 tickZero = cv::getTickCount();
+        const Match m = matcher(scaled, &multiScale, &refined);
+        const int64 tickOne = cv::getTickCount();
+        const Match e = exhaustiveScales(scaled, tmp, &exhaustive);
+        const int64 tickTwo = cv::getTickCount();
+        std::cout << std::setprecision(3) << "At scale " << f
+                  << ": multi-scale " << m.location << " at " << multiScale
+                  << " score " << m.score << " refining " << refined
+                  << std::setprecision(1) << " in "
+                  << (tickOne - tickZero) * msPerTick << " ms"
+                  << std::endl << std::setprecision(3)
+                  << "              exhaustive " << e.location
+                  << " at " << exhaustive << " score " << e.score
+                  << std::setprecision(1) << " in "
+                  << (tickTwo - tickOne) * msPerTick << " ms"
+                  << std::endl;
+    }
+}
+
+// Crop templates of several sizes from src at random locations and find
+// them with both cv::matchTemplate() over all of src and PyramidMatcher
+// with each method.  Report the average time of each, the speedup, and
+// how often the two found the same location.
+//
+static void benchmarkMatches(const cv::Mat &src)
+{
+    static const int sizes[] = { 32, 48, 64, 96, 128 };
+    static const int sizeCount = sizeof sizes / sizeof sizes[0];
+    static const int cropsPerSize = 4;
+    const double msPerTick = 1000.0 / cv::getTickFrequency();
+    cv::RNG rng;
+    std::vector<cv::Rect> crops;
+    for (int i = 0; i < sizeCount; ++i) {
+        for (int j = 0; j < cropsPerSize; ++j) {
+            const int side = std::min(sizes[i], std::min(src.rows, src.cols));
+            const int x = rng.uniform(0, src.cols - side + 1);
+            const int y = rng.uniform(0, src.rows - side + 1);
+            crops.push_back(cv::Rect(x, y, side, side));
+        }
+    }
+    std::cout << std::fixed << std::setprecision(2);
+    for (int m = 0; m < matchMethodCount; ++m) {
+        const MatchMethod &method = matchMethod[m];
+        const PyramidMatcher pyramid(method);
+        int64 exhaustiveTicks = 0, pyramidTicks = 0;
+        int agree = 0;
+        for (size_t i = 0; i < crops.size(); ++i) {
+            const cv::Mat tmp = src(crops[i]);
+            const int64 tickZero = cv::getTickCount();
+            cv::Mat matches;
+            cv::matchTemplate(src, tmp, matches, method.kind);
+            const cv::Point expect = matchLocation(matches, method.useMin);
+            const int64 tickOne = cv::getTickCount();
+            const cv::Point actual = pyramid(src, tmp);
+            const int64 tickTwo = cv::getTickCount();
+            exhaustiveTicks += tickOne - tickZero;
+            pyramidTicks += tickTwo - tickOne;
+            if (expect == actual) ++agree;
+        }
+        const double exhaustive = exhaustiveTicks * msPerTick / crops.size();
+        const double coarseToFine = pyramidTicks * msPerTick / crops.size();
+        std::cout << std::setw(22) << std::left << method.name
+                  << " exhaustive " << exhaustive << " ms, pyramid "
+                  << coarseToFine << " ms, speedup "
+                  << exhaustive / coarseToFine << ", agree " << agree
+                  << "/" << crops.size() << std::endl;
+    }
+}
+
 // Show the results of matching tmp against src with method.
 //
 static void showMatch(const cv::Mat &src, const cv::Mat &tmp,
@@ -127,7 +1107,32 @@ static bool showAllMatches(const cv::Mat &src, const cv::Mat &tmp)
 
 int main(int ac, const char *av[])
 {
-    if (ac == 3) {
+    if (ac == 3 && std::string("bench") == av[2]) {
+        const cv::Mat src = cv::imread(av[1]);
+        if (src.data) {
+            benchmarkMatches(src);
+            return 0;
+        }
+    } else if (ac > 3 && std::string("batch") == av[2]) {
+        const cv::Mat src = cv::imread(av[1]);
+        if (src.data) {
+            reportBatch(src, std::vector<std::string>(av + 3, av + ac));
+            return 0;
+        }
+    } else if (ac == 4 && std::string("track") == av[2]) {
+        const cv::Mat tmp = cv::imread(av[3]);
+        if (tmp.data) {
+            std::cout << std::endl << "Press 'q' to quit." << std::endl;
+            if (trackTemplate(av[1], tmp)) return 0;
+        }
+    } else if (ac == 4 && std::string("scale") == av[2]) {
+        const cv::Mat src = cv::imread(av[1]);
+        const cv::Mat tmp = cv::imread(av[3]);
+        if (src.data && tmp.data) {
+            reportScales(src, tmp);
+            return 0;
+        }
+    } else if (ac == 3) {
         const cv::Mat src = cv::imread(av[1]);
         const cv::Mat tmp = cv::imread(av[2]);
         if (src.data && tmp.data) {
@@ -140,13 +1145,42 @@ int main(int ac, const char *av[])
     std::cerr << av[0] << ": Demonstrate template matching."
               << std::endl << std::endl
               << "Usage: " << av[0] << " <image> <template>" << std::endl
+              << "       " << av[0] << " <image> bench" << std::endl
+              << "       " << av[0] << " <image> batch <template> ..."
+              << std::endl
+              << "       " << av[0] << " <video> track <template>"
+              << std::endl
+              << "       " << av[0] << " <image> scale <template>"
+              << std::endl
               << std::endl
               << "Where: <image> is an image file."
               << std::endl
+              << "       <video> is a video file."
+              << std::endl
               << "       <template> is a small region of <image>."
+              << std::endl
+              << "       bench times coarse-to-fine against exhaustive"
+              << " matching of crops of <image>."
+              << std::endl
+              << "       batch finds all the <template>s in <image>"
+              << " sharing one transform."
+              << std::endl
+              << "       track follows <template> through <video>."
+              << std::endl
+              << "       scale finds <template> across a ladder of scales"
+              << " in resized <image>s."
               << std::endl << std::endl
               << "Example: " << av[0]
               << " ../resources/marilyn-jane.jpg ../resources/jane.jpg"
-              << std::endl << std::endl;
+              << std::endl
+              << "Example: " << av[0] << " ../resources/lena.jpg bench"
+              << std::endl
+              << "Example: " << av[0] << " ../resources/marilyn-jane.jpg"
+              << " batch ../resources/jane.jpg" << std::endl
+              << "Example: " << av[0] << " ../resources/Megamind.avi"
+              << " track ../resources/megamind-lamp.png"
+              << std::endl
+              << "Example: " << av[0] << " ../resources/marilyn-jane.jpg"
+              << " scale ../resources/jane.jpg" << std::endl << std::endl;
     return 1;
 }